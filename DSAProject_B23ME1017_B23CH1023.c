@@ -1,489 +1,6654 @@
+// POSIX and BSD declarations (madvise, strcasecmp) also under a strict -std=c11.
+#define _DEFAULT_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// OpenMP directives are written OMP(parallel for ...) so that builds without
+// -fopenmp drop them instead of warning about unknown pragmas.
+#ifdef _OPENMP
+#define OMP(directive) _Pragma(OMP_STRING(omp directive))
+#define OMP_STRING(text) #text
+#else
+#define OMP(directive)
+#endif
 
-#define MAX_USERS 500
 #define MAX_NAME 100
 #define MAX_COUNTRY 50
-#define MAX_LINE 1024
-#define MAX_CONNECTIONS 50
-#define INF 99999
 
-// ANSI escape codes for text formatting
-#define COLOR_RESET   "\033[0m"
-#define COLOR_BOLD    "\033[1m"
-#define COLOR_CYAN    "\033[36m"
-#define COLOR_YELLOW  "\033[33m"
-#define COLOR_GREEN   "\033[32m"
+// ANSI escape codes for text formatting
+#define COLOR_RESET   "\033[0m"
+#define COLOR_BOLD    "\033[1m"
+#define COLOR_CYAN    "\033[36m"
+#define COLOR_YELLOW  "\033[33m"
+#define COLOR_GREEN   "\033[32m"
+
+// User data is stored column by column so that a scan over one field (a
+// follower threshold, a country filter, a sort key) only touches that field.
+// User i is user_ids[i], user_followers[i], user_activity[i] and
+// user_country_ids[i]; its name is a NUL-terminated string in string_pool at
+// user_name_offsets[i]. Use user_name() / user_country() to read the strings.
+int *user_ids = NULL;
+int *user_followers = NULL;
+float *user_activity = NULL;
+uint16_t *user_country_ids = NULL;
+size_t *user_name_offsets = NULL;
+int user_count = 0;
+int user_capacity = 0;
+
+// Users removed at runtime keep their slot (with no connections and no index
+// entries) until compact_graph() renumbers the rest. NULL until the graph
+// becomes mutable.
+bool *user_removed = NULL;
+int removed_user_count = 0;
+
+// When the users were reordered for locality at load time (reorder_graph()),
+// user_rows[i] is the row of user i in the input file and row_users[r] the
+// user at row r; both are NULL while users are stored in file order. Users
+// added at runtime take the next row.
+int *user_rows = NULL;
+int *row_users = NULL;
+
+// Backing storage for user names and countries. After load_users() this is the
+// CSV file itself, mapped copy-on-write with each field terminated in place.
+char *string_pool = NULL;
+size_t string_pool_size = 0;
+size_t string_pool_capacity = 0; // non-zero once the pool is an owned, growable buffer
+
+// Compressed sparse row (CSR) adjacency. The connections of user i are
+// adj_targets[adj_offsets[i]] .. adj_targets[adj_offsets[i + 1] - 1], stored as
+// user indices in ascending order. While loading, adj_targets holds the raw
+// connection IDs from the CSV; build_graph() resolves them in place.
+int *adj_offsets = NULL;
+int *adj_targets = NULL;
+int edge_count = 0;
+int edge_capacity = 0;
+
+// Reverse CSR adjacency: users that list user i as a connection, ascending.
+int *rev_offsets = NULL;
+int *rev_targets = NULL;
+
+// Once the graph is mutable the lists no longer have to be packed: list i then
+// ends at adj_ends[i] (rev_ends[i]) and may grow in place up to adj_limits[i]
+// (rev_limits[i]). Both are NULL while the adjacency is plain CSR.
+int *adj_ends = NULL;
+int *adj_limits = NULL;
+int *rev_ends = NULL;
+int *rev_limits = NULL;
+
+// Compressed form of both adjacency directions, built by compress_graph().
+// Each list is a run of LEB128 varints holding the gap minus one to the
+// previous entry, except at the start of a list and at every position that is
+// a multiple of ADJ_BLOCK, where the entry holds the zigzag-coded difference
+// from the list's owner. Those entries start blocks that decode on their own,
+// so list_bytes locates any list and block_bytes any position. Positions are
+// the CSR positions, so the offset arrays and degrees stay as they are; the
+// target arrays are NULL while the graph is compressed.
+#define ADJ_BLOCK 64
+
+typedef struct {
+    uint8_t *bytes;
+    size_t size;
+    size_t *list_bytes;  // byte offset of each user's list, plus the end
+    size_t *block_bytes; // byte offset of positions 0, ADJ_BLOCK, 2 * ADJ_BLOCK, ...
+} PackedLists;
+
+PackedLists packed_adj = { 0 };
+PackedLists packed_rev = { 0 };
+bool graph_compressed = false;
+
+// Open-addressing (linear probing) hash index from user ID to user index.
+typedef struct {
+    int id;
+    int index; // -1 marks an empty slot
+} IdSlot;
+
+IdSlot *id_index = NULL;
+uint32_t id_index_mask = 0;
+
+// Open-addressing hash index from case-folded name to the first user with that
+// name. Users sharing a name are chained in ascending index order via name_next.
+typedef struct {
+    uint32_t hash;
+    int index; // -1 marks an empty slot
+} NameSlot;
+
+NameSlot *name_index = NULL;
+uint32_t name_index_mask = 0;
+int *name_next = NULL;
+
+// Countries are interned: every distinct country (compared case-insensitively)
+// gets a small integer code, so country filters compare integers instead of
+// strings. Codes index 'offsets' (names in string_pool); 'slots' is an
+// open-addressing hash from case-folded name to code.
+#define MAX_COUNTRIES 65535
+
+typedef struct {
+    size_t *offsets;
+    int count, capacity;
+    NameSlot *slots; // index holds the country code, -1 marks an empty slot
+    uint32_t mask;
+} CountryTable;
+
+CountryTable countries = { 0 };
+
+// Allocates memory or exits with an error message.
+void *xmalloc(size_t size) {
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr) {
+        printf("Out of memory!\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+// Allocates zeroed memory or exits with an error message.
+void *xcalloc(size_t count, size_t size) {
+    void *ptr = calloc(count ? count : 1, size ? size : 1);
+    if (!ptr) {
+        printf("Out of memory!\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+// Resizes a block of memory or exits with an error message.
+void *xrealloc(void *ptr, size_t size) {
+    ptr = realloc(ptr, size ? size : 1);
+    if (!ptr) {
+        printf("Out of memory!\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+// Start and size of the mapped snapshot, or NULL when data came from a CSV.
+char *snapshot_data = NULL;
+size_t snapshot_size = 0;
+
+// Returns true if ptr points into the mapped snapshot.
+static inline bool in_snapshot(const void *ptr) {
+    const char *p = ptr;
+    return snapshot_data && p >= snapshot_data && p < snapshot_data + snapshot_size;
+}
+
+// Frees a global array unless it points into the mapped snapshot.
+void free_owned(void *ptr) {
+    if (!in_snapshot(ptr)) free(ptr);
+}
+
+// ---------------------------------------------------------------------------
+// Instrumentation
+//
+// Built only with -DINSTRUMENT; otherwise every macro below expands to
+// nothing. INSTRUMENT_SPAN(op) at the top of a function (or after its early
+// returns) times the rest of the enclosing scope with the monotonic clock and
+// records the latency in a per-operation log-linear (HDR-style) histogram:
+// 16 sub-buckets per power of two, so percentiles are within about 6%.
+// INSTRUMENT_COUNT(counter, n) adds to the calling thread's counter slot
+// without atomics. print_instrumentation() dumps everything, with per-structure
+// memory, as text or JSON.
+// ---------------------------------------------------------------------------
+
+typedef enum {
+    OP_LOAD_USERS,
+    OP_BUILD_INDEXES,
+    OP_BUILD_GRAPH,
+    OP_REORDER,
+    OP_COMPRESS,
+    OP_BUILD_SECONDARY_INDEXES,
+    OP_LOAD_SNAPSHOT,
+    OP_SAVE_SNAPSHOT,
+    OP_RESOLVE_USER,
+    OP_BFS,
+    OP_DFS,
+    OP_SHORTEST_PATH,
+    OP_REACHABILITY,
+    OP_STRONG_COMPONENTS,
+    OP_WEAK_COMPONENTS,
+    OP_ALL_PAIRS,
+    OP_HUB_BITMAPS,
+    OP_MUTUALS,
+    OP_RECOMMEND,
+    OP_PAGERANK,
+    OP_PERSONALIZED_PAGERANK,
+    OP_COMMUNITIES,
+    OP_TRIANGLES,
+    OP_SKETCHES,
+    OP_SIMILAR_USERS,
+    OP_TOP_N,
+    OP_INFLUENCE_TREE,
+    OP_ADD_USER,
+    OP_REMOVE_USER,
+    OP_ADD_CONNECTION,
+    OP_REMOVE_CONNECTION,
+    OP_COMPACT,
+    OP_BATCH_GROUP,
+    OP_COUNT
+} InstrumentOp;
+
+typedef enum {
+    COUNTER_ROWS_PARSED,
+    COUNTER_HASH_PROBES,
+    COUNTER_VERTICES_VISITED,
+    COUNTER_EDGES_SCANNED,
+    COUNTER_INTERSECTIONS,
+    COUNTER_COUNT
+} InstrumentCounter;
+
+#ifdef INSTRUMENT
+
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+#define INSTRUMENT_MAX_THREADS 256
+
+static const char *instrument_op_names[OP_COUNT] = {
+    "load_users", "build_indexes", "build_graph", "reorder", "compress", "build_secondary_indexes", "load_snapshot",
+    "save_snapshot", "resolve_user", "bfs", "dfs", "shortest_path", "reachability",
+    "strong_components", "weak_components", "all_pairs", "hub_bitmaps", "mutuals", "recommend",
+    "pagerank", "personalized_pagerank", "communities", "triangles", "sketches", "similar_users",
+    "top_n", "influence_tree", "add_user", "remove_user", "add_connection", "remove_connection", "compact", "batch_group"
+};
+static const char *instrument_counter_names[COUNTER_COUNT] = {
+    "rows_parsed", "hash_probes", "vertices_visited", "edges_scanned", "intersections"
+};
+
+// Latency histogram of one operation, in nanoseconds.
+typedef struct {
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+    uint64_t count, total_ns, max_ns;
+} LatencyHistogram;
+
+LatencyHistogram op_histograms[OP_COUNT];
+
+// One cache line of counters per thread.
+typedef struct {
+    uint64_t values[COUNTER_COUNT];
+    char padding[64 - (COUNTER_COUNT * sizeof(uint64_t)) % 64];
+} CounterSlot;
+
+CounterSlot counter_slots[INSTRUMENT_MAX_THREADS];
+
+// Returns the monotonic clock in nanoseconds.
+static inline uint64_t instrument_now_ns() {
+#ifdef _WIN32
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Values below 16 get a bucket each; above that, each power of two is split
+// into 16 equal sub-buckets.
+static inline int histogram_bucket(uint64_t value) {
+    if (value < HISTOGRAM_SUB_BUCKETS) return (int)value;
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - HISTOGRAM_SUB_BITS;
+    return (msb - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS + (int)((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+// Returns the highest value that falls into a bucket.
+static uint64_t histogram_bucket_limit(int bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS) return (uint64_t)bucket;
+    int shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+    uint64_t low = (uint64_t)(HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS) << shift;
+    return low + ((1ull << shift) - 1);
+}
+
+static void histogram_record(LatencyHistogram *histogram, uint64_t ns) {
+    int bucket = histogram_bucket(ns);
+    OMP(atomic)
+    histogram->buckets[bucket]++;
+    OMP(atomic)
+    histogram->count++;
+    OMP(atomic)
+    histogram->total_ns += ns;
+    uint64_t max = histogram->max_ns;
+    while (ns > max && !__sync_bool_compare_and_swap(&histogram->max_ns, max, ns)) max = histogram->max_ns;
+}
+
+// Returns the value at quantile q (0..1) of a histogram, rounded up to its bucket.
+static uint64_t histogram_percentile(const LatencyHistogram *histogram, double q) {
+    uint64_t rank = (uint64_t)ceil(q * histogram->count), seen = 0;
+    if (rank == 0) rank = 1;
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        seen += histogram->buckets[b];
+        if (seen >= rank) {
+            uint64_t limit = histogram_bucket_limit(b);
+            return limit < histogram->max_ns ? limit : histogram->max_ns;
+        }
+    }
+    return histogram->max_ns;
+}
+
+// An open span: the operation and its start time.
+typedef struct {
+    InstrumentOp op;
+    uint64_t start_ns;
+} InstrumentSpan;
+
+static inline InstrumentSpan span_begin(InstrumentOp op) {
+    return (InstrumentSpan){ op, instrument_now_ns() };
+}
+
+static inline void span_end(InstrumentSpan *span) {
+    histogram_record(&op_histograms[span->op], instrument_now_ns() - span->start_ns);
+}
+
+// Each OS thread takes a counter slot on first use and keeps it.
+int instrument_next_slot = 0;
+static _Thread_local int instrument_slot = -1;
+
+static inline int instrument_thread() {
+    if (instrument_slot < 0) instrument_slot = __sync_fetch_and_add(&instrument_next_slot, 1) & (INSTRUMENT_MAX_THREADS - 1);
+    return instrument_slot;
+}
+
+#define INSTRUMENT_SPAN(op) \
+    InstrumentSpan instrument_span __attribute__((cleanup(span_end))) = span_begin(op)
+#define INSTRUMENT_COUNT(counter, n) \
+    (counter_slots[instrument_thread()].values[counter] += (uint64_t)(n))
+
+#else
+
+#define INSTRUMENT_SPAN(op) ((void)0)
+#define INSTRUMENT_COUNT(counter, n) ((void)0)
+
+#endif
+
+// Returns the string stored at the given offset of string_pool.
+static inline const char *pool_string(size_t offset) {
+    return string_pool + offset;
+}
+
+// Returns the name of user i.
+static inline const char *user_name(int i) {
+    return string_pool + user_name_offsets[i];
+}
+
+// Returns the name of interned country 'code'.
+static inline const char *country_name(int code) {
+    return string_pool + countries.offsets[code];
+}
+
+// Returns the country of user i.
+static inline const char *user_country(int i) {
+    return country_name(user_country_ids[i]);
+}
+
+// Returns the index of the first connection of user v in adj_targets.
+static inline int adj_begin(int v) {
+    return adj_offsets[v];
+}
+
+// Returns the index one past the last connection of user v in adj_targets.
+static inline int adj_end(int v) {
+    return adj_ends ? adj_ends[v] : adj_offsets[v + 1];
+}
+
+// Returns the number of (resolved) connections of user v.
+static inline int out_degree(int v) {
+    return adj_end(v) - adj_offsets[v];
+}
+
+// Returns the index of the first reverse connection of user v in rev_targets.
+static inline int rev_begin(int v) {
+    return rev_offsets[v];
+}
+
+// Returns the index one past the last reverse connection of user v in rev_targets.
+static inline int rev_end(int v) {
+    return rev_ends ? rev_ends[v] : rev_offsets[v + 1];
+}
+
+// Returns the number of users that list user v as a connection.
+static inline int in_degree(int v) {
+    return rev_end(v) - rev_offsets[v];
+}
+
+// Walks one neighbour list in either form, in ascending order:
+//     NeighbourCursor c = out_neighbours(v);
+//     for (int w; next_neighbour(&c, &w);) ...
+// 'position' is the CSR position of the next entry.
+typedef struct {
+    const int *targets;   // CSR targets, or NULL when compressed
+    const uint8_t *bytes; // next encoded entry
+    int position, end, begin, owner, last;
+} NeighbourCursor;
+
+// Decodes one LEB128 varint and advances *p past it.
+static inline uint32_t read_varint(const uint8_t **p) {
+    const uint8_t *q = *p;
+    uint32_t x = *q++;
+    if (x >= 0x80) {
+        x &= 0x7F;
+        int shift = 7;
+        uint32_t byte;
+        do {
+            byte = *q++;
+            x |= (byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte >= 0x80);
+    }
+    *p = q;
+    return x;
+}
+
+// Returns a cursor over the connections of user v.
+static inline NeighbourCursor out_neighbours(int v) {
+    NeighbourCursor c = { adj_targets, NULL, adj_begin(v), adj_end(v), adj_begin(v), v, 0 };
+    if (!c.targets) c.bytes = packed_adj.bytes + packed_adj.list_bytes[v];
+    return c;
+}
+
+// Returns a cursor over the users that list user v as a connection.
+static inline NeighbourCursor in_neighbours(int v) {
+    NeighbourCursor c = { rev_targets, NULL, rev_begin(v), rev_end(v), rev_begin(v), v, 0 };
+    if (!c.targets) c.bytes = packed_rev.bytes + packed_rev.list_bytes[v];
+    return c;
+}
+
+// Stores the next entry in *w and returns true, or returns false at the end.
+static inline bool next_neighbour(NeighbourCursor *c, int *w) {
+    if (c->position == c->end) return false;
+    if (c->targets) {
+        *w = c->targets[c->position++];
+        return true;
+    }
+    uint32_t x = read_varint(&c->bytes);
+    if (c->position == c->begin || (c->position & (ADJ_BLOCK - 1)) == 0) c->last = c->owner + (int)((x >> 1) ^ (0u - (x & 1)));
+    else c->last += (int)x + 1;
+    c->position++;
+    *w = c->last;
+    return true;
+}
+
+// Returns the next entry of the cursor, or INT_MAX at the end.
+static inline int next_neighbour_or_max(NeighbourCursor *c) {
+    int w;
+    return next_neighbour(c, &w) ? w : INT_MAX;
+}
+
+// Returns a cursor over the connections of user v that starts at CSR position
+// e. A compressed list is entered at the nearest block, so this decodes fewer
+// than ADJ_BLOCK entries.
+static inline NeighbourCursor out_neighbours_from(int v, int e) {
+    NeighbourCursor c = out_neighbours(v);
+    if (c.targets) {
+        c.position = e;
+        return c;
+    }
+    int anchor = e & ~(ADJ_BLOCK - 1);
+    if (anchor > c.begin) {
+        c.position = anchor;
+        c.bytes = packed_adj.bytes + packed_adj.block_bytes[anchor / ADJ_BLOCK];
+    }
+    for (int w; c.position < e;) next_neighbour(&c, &w);
+    return c;
+}
+
+// Returns true if user i was removed at runtime.
+static inline bool is_user_removed(int i) {
+    return user_removed && user_removed[i];
+}
+
+// Returns the number of users that have not been removed.
+static inline int live_user_count() {
+    return user_count - removed_user_count;
+}
+
+// Returns the input file row of user i.
+static inline int user_row(int i) {
+    return user_rows ? user_rows[i] : i;
+}
+
+// Returns the user at input file row r.
+static inline int row_user(int r) {
+    return row_users ? row_users[r] : r;
+}
+
+// Orders two users by file row, so ties come out the same however the users
+// are laid out in memory.
+static inline int compare_rows(int x, int y) {
+    return (user_row(x) > user_row(y)) - (user_row(x) < user_row(y));
+}
+
+// Removes the newline character from the end of a string.
+void trim_newline(char *str) {
+    str[strcspn(str, "\n")] = 0;
+}
+
+// Maps a whole file into memory as a private, writable (copy-on-write) view so
+// the parser can terminate fields in place. 'sequential' hints that the file
+// will be read front to back. Returns NULL if the file cannot be opened or is empty.
+char *map_file(const char *filename, size_t *size, bool sequential) {
+#ifdef _WIN32
+    (void)sequential;
+    FILE *file = fopen(filename, "rb");
+    if (!file) return NULL;
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (length <= 0) {
+        fclose(file);
+        return NULL;
+    }
+    char *data = xmalloc((size_t)length);
+    *size = fread(data, 1, (size_t)length, file);
+    fclose(file);
+    return data;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    char *data = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
+    madvise(data, (size_t)st.st_size, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+    *size = (size_t)st.st_size;
+    return data;
+#endif
+}
+
+// Releases a view returned by map_file().
+void unmap_file(char *data, size_t size) {
+#ifdef _WIN32
+    (void)size;
+    free(data);
+#else
+    munmap(data, size);
+#endif
+}
+
+// Parses an optionally signed decimal integer starting at *p. On success,
+// advances *p past the digits and returns true.
+static bool parse_int_field(char **p, char *end, int *out) {
+    char *s = *p;
+    bool negative = false;
+    if (s < end && (*s == '-' || *s == '+')) negative = (*s++ == '-');
+    if (s == end || !isdigit((unsigned char)*s)) return false;
+    long long value = 0;
+    while (s < end && isdigit((unsigned char)*s)) {
+        value = value * 10 + (*s++ - '0');
+        if (value > 2147483648LL) return false;
+    }
+    if (negative) value = -value;
+    if (value > 2147483647LL) return false;
+    *out = (int)value;
+    *p = s;
+    return true;
+}
+
+// Parses a decimal number such as "4.08", "-1.5e3" or "7" starting at *p. On
+// success, advances *p past the number and returns true.
+static bool parse_float_field(char **p, char *end, float *out) {
+    static const double powers_of_ten[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    char *s = *p;
+    bool negative = false;
+    if (s < end && (*s == '-' || *s == '+')) negative = (*s++ == '-');
+
+    uint64_t mantissa = 0;
+    int exponent = 0, digits = 0;
+    for (; s < end && isdigit((unsigned char)*s); s++, digits++) {
+        if (mantissa < 100000000000000000ULL) mantissa = mantissa * 10 + (uint64_t)(*s - '0');
+        else exponent++;
+    }
+    if (s < end && *s == '.') {
+        for (s++; s < end && isdigit((unsigned char)*s); s++, digits++) {
+            if (mantissa < 100000000000000000ULL) {
+                mantissa = mantissa * 10 + (uint64_t)(*s - '0');
+                exponent--;
+            }
+        }
+    }
+    if (digits == 0) return false;
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        s++;
+        int e;
+        if (!parse_int_field(&s, end, &e) || e < -300 || e > 300) return false;
+        exponent += e;
+    }
+
+    double value = (double)mantissa;
+    while (exponent > 22) { value *= 1e22; exponent -= 22; }
+    while (exponent < -22) { value /= 1e22; exponent += 22; }
+    value = exponent >= 0 ? value * powers_of_ten[exponent] : value / powers_of_ten[-exponent];
+    *out = (float)(negative ? -value : value);
+    *p = s;
+    return true;
+}
+
+uint32_t hash_name(const char *name);
+
+// Looks up a country by name (case-insensitive). Returns its code or -1.
+int country_table_find(const CountryTable *table, const char *name) {
+    if (!table->slots) return -1;
+    uint32_t h = hash_name(name);
+    for (uint32_t s = h & table->mask; table->slots[s].index != -1; s = (s + 1) & table->mask) {
+        INSTRUMENT_COUNT(COUNTER_HASH_PROBES, 1);
+        if (table->slots[s].hash == h && strcasecmp(string_pool + table->offsets[table->slots[s].index], name) == 0)
+            return table->slots[s].index;
+    }
+    return -1;
+}
+
+// Returns the code of the country stored at 'offset' in string_pool, adding
+// it to the table on first use.
+int country_table_intern(CountryTable *table, size_t offset) {
+    const char *name = string_pool + offset;
+    int code = country_table_find(table, name);
+    if (code != -1) return code;
+
+    if (table->count == table->capacity) {
+        table->capacity = table->capacity ? table->capacity * 2 : 64;
+        table->offsets = xrealloc(table->offsets, sizeof(size_t) * table->capacity);
+        // Keep the load factor at or below 1/2 by rehashing into a larger table.
+        free(table->slots);
+        table->mask = (uint32_t)table->capacity * 2 - 1;
+        table->slots = xmalloc(sizeof(NameSlot) * (table->mask + 1));
+        for (uint32_t s = 0; s <= table->mask; s++) table->slots[s].index = -1;
+        for (int c = 0; c < table->count; c++) {
+            uint32_t h = hash_name(string_pool + table->offsets[c]);
+            uint32_t s = h & table->mask;
+            while (table->slots[s].index != -1) s = (s + 1) & table->mask;
+            table->slots[s].hash = h;
+            table->slots[s].index = c;
+        }
+    }
+
+    code = table->count++;
+    table->offsets[code] = offset;
+    uint32_t h = hash_name(name);
+    uint32_t s = h & table->mask;
+    while (table->slots[s].index != -1) s = (s + 1) & table->mask;
+    table->slots[s].hash = h;
+    table->slots[s].index = code;
+    return code;
+}
+
+// Finds the interned code of a country by name (case-insensitive), or -1.
+int find_country(const char *name) {
+    return country_table_find(&countries, name);
+}
+
+// One parsed CSV row. Only used while loading, before the rows are scattered
+// into the user columns.
+typedef struct {
+    int id;
+    int followers;
+    float activity_score;
+    int country;        // chunk-local country code
+    size_t name_offset;
+} CsvRow;
+
+// A newline-aligned slice of the CSV body together with the rows parsed from it.
+typedef struct {
+    char *begin, *end;
+    CsvRow *rows;
+    int user_count, user_capacity;
+    CountryTable countries; // countries seen in this chunk
+    int *conn_offsets;      // local CSR offsets into conn_ids, user_count + 1 entries
+    int *conn_ids;          // raw connection IDs
+    long long conn_count, conn_capacity;
+    long long lines;        // newline-terminated lines in this chunk
+    long long error_line;   // 0-based line within the chunk, -1 if none
+    const char *error;
+} CsvChunk;
+
+// Parses one CSV row [p, line_end) into the chunk. Names and countries are
+// NUL-terminated in place and referenced by their offset in string_pool.
+// Returns NULL on success or a description of the problem.
+static const char *parse_csv_row(char *p, char *line_end, CsvChunk *chunk) {
+    CsvRow user;
+    char *comma;
+
+    if (!parse_int_field(&p, line_end, &user.id) || p == line_end || *p != ',')
+        return "invalid user id";
+    p++;
+
+    comma = memchr(p, ',', (size_t)(line_end - p));
+    if (!comma) return "missing followers field";
+    if (comma == p) return "empty name";
+    *comma = '\0';
+    user.name_offset = (size_t)(p - string_pool);
+    p = comma + 1;
+
+    if (!parse_int_field(&p, line_end, &user.followers) || p == line_end || *p != ',')
+        return "invalid followers count";
+    p++;
+
+    if (!parse_float_field(&p, line_end, &user.activity_score) || p == line_end || *p != ',')
+        return "invalid activity score";
+    p++;
+
+    comma = memchr(p, ',', (size_t)(line_end - p));
+    if (!comma) return "missing connections field";
+    *comma = '\0';
+    user.country = country_table_intern(&chunk->countries, (size_t)(p - string_pool));
+    if (chunk->countries.count > MAX_COUNTRIES) return "too many distinct countries";
+    p = comma + 1;
+
+    while (true) {
+        while (p < line_end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+        if (p == line_end) break;
+        int conn_id;
+        if (!parse_int_field(&p, line_end, &conn_id))
+            return "invalid connection id";
+        if (chunk->conn_count == chunk->conn_capacity) {
+            chunk->conn_capacity = chunk->conn_capacity ? chunk->conn_capacity * 2 : 1024;
+            chunk->conn_ids = xrealloc(chunk->conn_ids, sizeof(int) * chunk->conn_capacity);
+        }
+        chunk->conn_ids[chunk->conn_count++] = conn_id;
+    }
+
+    if (chunk->user_count == chunk->user_capacity) {
+        chunk->user_capacity = chunk->user_capacity ? chunk->user_capacity * 2 : 256;
+        chunk->rows = xrealloc(chunk->rows, sizeof(CsvRow) * chunk->user_capacity);
+        chunk->conn_offsets = xrealloc(chunk->conn_offsets, sizeof(int) * (chunk->user_capacity + 1));
+    }
+    chunk->rows[chunk->user_count++] = user;
+    if (chunk->conn_count > 2147483647LL) return "too many connections";
+    chunk->conn_offsets[chunk->user_count] = (int)chunk->conn_count;
+    return NULL;
+}
+
+// Parses every row of a chunk, stopping at the first malformed one.
+static void parse_csv_chunk(CsvChunk *chunk) {
+    chunk->conn_offsets = xmalloc(sizeof(int));
+    chunk->conn_offsets[0] = 0;
+    chunk->error_line = -1;
+    char *p = chunk->begin;
+    while (p < chunk->end) {
+        char *line_end = memchr(p, '\n', (size_t)(chunk->end - p));
+        if (!line_end) line_end = chunk->end;
+        char *q = p;
+        while (q < line_end && isspace((unsigned char)*q)) q++;
+        if (q < line_end) { // skip blank lines
+            chunk->error = parse_csv_row(p, line_end, chunk);
+            if (chunk->error) {
+                chunk->error_line = chunk->lines;
+                return;
+            }
+            INSTRUMENT_COUNT(COUNTER_ROWS_PARSED, 1);
+        }
+        chunk->lines++;
+        p = line_end + 1;
+    }
+}
+
+// Loads user data from a CSV file into the user columns and the raw
+// connection lists into adj_offsets / adj_targets.
+// The file is memory-mapped and split into newline-aligned chunks that are
+// parsed in parallel (OpenMP), then concatenated in file order. Each chunk
+// interns its countries locally; the local codes are remapped to global ones
+// while scattering. Malformed rows are reported with their line number.
+void load_users(const char *filename) {
+    INSTRUMENT_SPAN(OP_LOAD_USERS);
+    size_t size = 0;
+    char *data = map_file(filename, &size, true);
+    if (!data) {
+        printf("Error opening file!\n");
+        exit(1);
+    }
+    string_pool = data;
+    string_pool_size = size;
+
+    char *end = data + size;
+    char *body = memchr(data, '\n', size); // skip header
+    body = body ? body + 1 : end;
+
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    const size_t min_chunk_bytes = 1 << 20;
+    size_t body_size = (size_t)(end - body);
+    int chunk_count = threads * 4;
+    if ((size_t)chunk_count > body_size / min_chunk_bytes) chunk_count = (int)(body_size / min_chunk_bytes);
+    if (chunk_count < 1) chunk_count = 1;
+
+    CsvChunk *chunks = xcalloc(chunk_count, sizeof(CsvChunk));
+    char *cursor = body;
+    for (int c = 0; c < chunk_count; c++) {
+        chunks[c].begin = cursor;
+        char *split = (c == chunk_count - 1) ? end : body + body_size / chunk_count * (c + 1);
+        if (split < cursor) split = cursor;
+        if (split < end) {
+            char *newline = memchr(split, '\n', (size_t)(end - split));
+            split = newline ? newline + 1 : end;
+        }
+        chunks[c].end = split;
+        cursor = split;
+    }
+
+    OMP(parallel for schedule(dynamic, 1))
+    for (int c = 0; c < chunk_count; c++) {
+        parse_csv_chunk(&chunks[c]);
+    }
+
+    long long line_base = 2; // line 1 is the header
+    long long total_users = 0, total_edges = 0;
+    for (int c = 0; c < chunk_count; c++) {
+        if (chunks[c].error) {
+            printf("Error in %s line %lld: %s\n", filename, line_base + chunks[c].error_line, chunks[c].error);
+            exit(1);
+        }
+        line_base += chunks[c].lines;
+        total_users += chunks[c].user_count;
+        total_edges += chunks[c].conn_count;
+    }
+    if (total_users > 2147483646LL || total_edges > 2147483647LL) {
+        printf("Error in %s: too many users or connections\n", filename);
+        exit(1);
+    }
+
+    user_count = user_capacity = (int)total_users;
+    edge_count = edge_capacity = (int)total_edges;
+    user_ids = xmalloc(sizeof(int) * user_count);
+    user_followers = xmalloc(sizeof(int) * user_count);
+    user_activity = xmalloc(sizeof(float) * user_count);
+    user_country_ids = xmalloc(sizeof(uint16_t) * user_count);
+    user_name_offsets = xmalloc(sizeof(size_t) * user_count);
+    adj_offsets = xmalloc(sizeof(int) * (user_count + 1));
+    adj_targets = xmalloc(sizeof(int) * edge_count);
+    adj_offsets[0] = 0;
+
+    int *user_base = xmalloc(sizeof(int) * chunk_count);
+    int *edge_base = xmalloc(sizeof(int) * chunk_count);
+    for (int c = 0, u = 0, e = 0; c < chunk_count; c++) {
+        user_base[c] = u;
+        edge_base[c] = e;
+        u += chunks[c].user_count;
+        e += (int)chunks[c].conn_count;
+    }
+
+    // Merge the chunk-local country tables in file order, so codes follow
+    // first appearance in the file.
+    int **country_maps = xmalloc(sizeof(int *) * chunk_count);
+    for (int c = 0; c < chunk_count; c++) {
+        CountryTable *local = &chunks[c].countries;
+        country_maps[c] = xmalloc(sizeof(int) * (local->count ? local->count : 1));
+        for (int k = 0; k < local->count; k++)
+            country_maps[c][k] = country_table_intern(&countries, local->offsets[k]);
+        if (countries.count > MAX_COUNTRIES) {
+            printf("Error in %s: more than %d distinct countries\n", filename, MAX_COUNTRIES);
+            exit(1);
+        }
+    }
+
+    OMP(parallel for schedule(dynamic, 1))
+    for (int c = 0; c < chunk_count; c++) {
+        CsvChunk *chunk = &chunks[c];
+        const int *country_map = country_maps[c];
+        for (int k = 0; k < chunk->user_count; k++) {
+            const CsvRow *row = &chunk->rows[k];
+            int u = user_base[c] + k;
+            user_ids[u] = row->id;
+            user_followers[u] = row->followers;
+            user_activity[u] = row->activity_score;
+            user_country_ids[u] = (uint16_t)country_map[row->country];
+            user_name_offsets[u] = row->name_offset;
+        }
+        memcpy(adj_targets + edge_base[c], chunk->conn_ids, sizeof(int) * chunk->conn_count);
+        for (int k = 0; k < chunk->user_count; k++)
+            adj_offsets[user_base[c] + k + 1] = edge_base[c] + chunk->conn_offsets[k + 1];
+        free(chunk->rows);
+        free(chunk->conn_offsets);
+        free(chunk->conn_ids);
+        free(chunk->countries.offsets);
+        free(chunk->countries.slots);
+        free(country_maps[c]);
+    }
+    free(country_maps);
+    free(edge_base);
+    free(user_base);
+    free(chunks);
+}
+
+// Hashes a user ID (Fibonacci hashing followed by a final mix).
+static inline uint32_t hash_id(int id) {
+    uint32_t h = (uint32_t)id * 0x9E3779B1u;
+    return h ^ (h >> 16);
+}
+
+// Hashes a name case-insensitively (FNV-1a over lower-cased bytes).
+uint32_t hash_name(const char *name) {
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        h ^= (uint32_t)tolower(*p);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Returns a power-of-two table size with a load factor of at most 1/2.
+uint32_t index_table_size(int count) {
+    uint32_t size = 16;
+    while (size < (uint32_t)count * 2) size <<= 1;
+    return size;
+}
+
+// Builds the ID and name hash indexes over the user columns. When IDs repeat,
+// the first user with that ID in the file wins, matching the old linear scan,
+// and name chains follow file order.
+void build_indexes() {
+    INSTRUMENT_SPAN(OP_BUILD_INDEXES);
+    uint32_t size = index_table_size(user_count);
+
+    free_owned(id_index);
+    id_index = xmalloc(sizeof(IdSlot) * size);
+    id_index_mask = size - 1;
+    for (uint32_t s = 0; s < size; s++) id_index[s].index = -1;
+
+    free_owned(name_index);
+    name_index = xmalloc(sizeof(NameSlot) * size);
+    name_index_mask = size - 1;
+    for (uint32_t s = 0; s < size; s++) name_index[s].index = -1;
+
+    free_owned(name_next);
+    name_next = xmalloc(sizeof(int) * (user_capacity ? user_capacity : 1));
+    // Tail of each name chain, kept per slot while building so appends are O(1).
+    int *name_tail = xmalloc(sizeof(int) * size);
+
+    for (int r = 0; r < user_count; r++) {
+        int i = row_user(r);
+        name_next[i] = -1;
+        if (is_user_removed(i)) continue;
+        uint32_t s = hash_id(user_ids[i]) & id_index_mask;
+        while (id_index[s].index != -1 && id_index[s].id != user_ids[i])
+            s = (s + 1) & id_index_mask;
+        if (id_index[s].index == -1) {
+            id_index[s].id = user_ids[i];
+            id_index[s].index = i;
+        }
+
+        uint32_t h = hash_name(user_name(i));
+        s = h & name_index_mask;
+        while (name_index[s].index != -1 &&
+               (name_index[s].hash != h || strcasecmp(user_name(name_index[s].index), user_name(i)) != 0))
+            s = (s + 1) & name_index_mask;
+        if (name_index[s].index == -1) {
+            name_index[s].hash = h;
+            name_index[s].index = i;
+        } else {
+            name_next[name_tail[s]] = i;
+        }
+        name_tail[s] = i;
+    }
+    free(name_tail);
+}
+
+// Finds the index of a user among the users by their name (case-insensitive).
+// When several users share the name, the first one is returned; use
+// next_user_with_same_name() to visit the others.
+int find_user_by_name(const char *name) {
+    uint32_t h = hash_name(name);
+    for (uint32_t s = h & name_index_mask; name_index[s].index != -1; s = (s + 1) & name_index_mask) {
+        INSTRUMENT_COUNT(COUNTER_HASH_PROBES, 1);
+        if (name_index[s].hash == h && strcasecmp(user_name(name_index[s].index), name) == 0)
+            return name_index[s].index;
+    }
+    return -1;
+}
+
+// Returns the next user (in file order) with the same name as user 'index', or -1.
+int next_user_with_same_name(int index) {
+    return name_next[index];
+}
+
+// Finds the index of a user among the users by their ID.
+int find_user_by_id(int id) {
+    for (uint32_t s = hash_id(id) & id_index_mask; id_index[s].index != -1; s = (s + 1) & id_index_mask) {
+        INSTRUMENT_COUNT(COUNTER_HASH_PROBES, 1);
+        if (id_index[s].id == id) return id_index[s].index;
+    }
+    return -1;
+}
+
+// Comparison function for sorting integers in ascending order.
+int compareInts(const void *a, const void *b) {
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// Builds the reverse CSR (in-edges) from the forward adjacency with a counting
+// sort. Sources are visited in ascending order, so every list comes out sorted.
+void build_reverse_graph() {
+    free_owned(rev_offsets);
+    free_owned(rev_targets);
+    rev_offsets = xcalloc(user_count + 1, sizeof(int));
+    rev_targets = xmalloc(sizeof(int) * edge_count);
+    for (int e = 0; e < edge_count; e++) rev_offsets[adj_targets[e] + 1]++;
+    for (int v = 0; v < user_count; v++) rev_offsets[v + 1] += rev_offsets[v];
+    int *fill = xmalloc(sizeof(int) * (user_count ? user_count : 1));
+    memcpy(fill, rev_offsets, sizeof(int) * user_count);
+    for (int v = 0; v < user_count; v++) {
+        for (int e = adj_begin(v); e < adj_end(v); e++) {
+            rev_targets[fill[adj_targets[e]]++] = v;
+        }
+    }
+    free(fill);
+}
+
+// Builds the CSR adjacency from the raw connection IDs read by load_users().
+// IDs are resolved through the ID index (build_indexes() must run first),
+// unknown IDs are dropped, and every neighbour list is sorted and de-duplicated.
+void build_graph() {
+    INSTRUMENT_SPAN(OP_BUILD_GRAPH);
+    int write = 0;
+    int read_begin = adj_offsets[0];
+    for (int v = 0; v < user_count; v++) {
+        int read_end = adj_offsets[v + 1];
+        int list_begin = write;
+        for (int e = read_begin; e < read_end; e++) {
+            int target = find_user_by_id(adj_targets[e]);
+            if (target != -1) adj_targets[write++] = target;
+        }
+        qsort(adj_targets + list_begin, write - list_begin, sizeof(int), compareInts);
+        int unique_end = list_begin;
+        for (int e = list_begin; e < write; e++) {
+            if (unique_end == list_begin || adj_targets[unique_end - 1] != adj_targets[e])
+                adj_targets[unique_end++] = adj_targets[e];
+        }
+        write = unique_end;
+        adj_offsets[v] = list_begin;
+        read_begin = read_end;
+    }
+    adj_offsets[user_count] = write;
+    edge_count = write;
+    edge_capacity = write;
+    adj_targets = xrealloc(adj_targets, sizeof(int) * edge_count);
+    build_reverse_graph();
+}
+
+// ---------------------------------------------------------------------------
+// Compressed adjacency
+//
+// compress_graph() replaces both CSR target arrays (4 bytes per entry) with
+// delta + varint coded lists (see PackedLists). Hubs and users renumbered by
+// --reorder have small gaps, most of which fit in one byte. Traversals read
+// the lists through NeighbourCursor, decoding as they go, so nothing is
+// expanded to answer a query; the first mutation, or writing a snapshot,
+// expands them back with decompress_graph().
+// ---------------------------------------------------------------------------
+
+// Writes x as a LEB128 varint to 'out' (if non-NULL) and returns its length.
+static inline int write_varint(uint8_t *out, uint32_t x) {
+    int length = 0;
+    while (x >= 0x80) {
+        if (out) out[length] = (uint8_t)(x | 0x80);
+        x >>= 7;
+        length++;
+    }
+    if (out) out[length] = (uint8_t)x;
+    return length + 1;
+}
+
+// Encodes the list of 'owner' (CSR positions begin .. end - 1 of 'targets')
+// to 'out', recording block starts in 'block_bytes' relative to 'base'. With
+// 'out' NULL only measures it. Returns its length in bytes.
+static size_t encode_list(int owner, int begin, int end, const int *targets, uint8_t *out, size_t *block_bytes, size_t base) {
+    size_t length = 0;
+    for (int e = begin; e < end; e++) {
+        uint32_t x;
+        if (e == begin || (e & (ADJ_BLOCK - 1)) == 0) {
+            long long difference = (long long)targets[e] - owner;
+            x = (uint32_t)(difference >= 0 ? 2 * difference : -2 * difference - 1);
+            if (out && (e & (ADJ_BLOCK - 1)) == 0) block_bytes[e / ADJ_BLOCK] = base + length;
+        } else {
+            x = (uint32_t)(targets[e] - targets[e - 1] - 1);
+        }
+        length += write_varint(out ? out + length : NULL, x);
+    }
+    return length;
+}
+
+// Encodes every list of one CSR direction into 'packed'.
+static void pack_lists(PackedLists *packed, const int *offsets, const int *targets) {
+    int n = user_count;
+    packed->list_bytes = xmalloc(sizeof(size_t) * (n + 1));
+    packed->block_bytes = xmalloc(sizeof(size_t) * ((size_t)edge_count / ADJ_BLOCK + 1));
+    packed->list_bytes[0] = 0;
+    OMP(parallel for schedule(dynamic, 1024))
+    for (int v = 0; v < n; v++)
+        packed->list_bytes[v + 1] = encode_list(v, offsets[v], offsets[v + 1], targets, NULL, NULL, 0);
+    for (int v = 0; v < n; v++) packed->list_bytes[v + 1] += packed->list_bytes[v];
+    packed->size = packed->list_bytes[n];
+    packed->bytes = xmalloc(packed->size ? packed->size : 1);
+    OMP(parallel for schedule(dynamic, 1024))
+    for (int v = 0; v < n; v++)
+        encode_list(v, offsets[v], offsets[v + 1], targets, packed->bytes + packed->list_bytes[v],
+                    packed->block_bytes, packed->list_bytes[v]);
+}
+
+// Releases the buffers of 'packed'.
+static void free_packed_lists(PackedLists *packed) {
+    free(packed->bytes);
+    free(packed->list_bytes);
+    free(packed->block_bytes);
+    memset(packed, 0, sizeof(*packed));
+}
+
+// Compresses both adjacency directions of a packed (not yet mutated) graph and
+// drops the CSR target arrays.
+void compress_graph() {
+    if (graph_compressed) return;
+    INSTRUMENT_SPAN(OP_COMPRESS);
+    pack_lists(&packed_adj, adj_offsets, adj_targets);
+    pack_lists(&packed_rev, rev_offsets, rev_targets);
+    free_owned(adj_targets);
+    free_owned(rev_targets);
+    adj_targets = rev_targets = NULL;
+    graph_compressed = true;
+}
+
+// Expands the compressed lists back into CSR target arrays.
+void decompress_graph() {
+    if (!graph_compressed) return;
+    int n = user_count;
+    int *targets = xmalloc(sizeof(int) * (edge_count ? edge_count : 1));
+    int *sources = xmalloc(sizeof(int) * (edge_count ? edge_count : 1));
+    OMP(parallel for schedule(dynamic, 1024))
+    for (int v = 0; v < n; v++) {
+        NeighbourCursor out = out_neighbours(v), in = in_neighbours(v);
+        for (int w; next_neighbour(&out, &w);) targets[out.position - 1] = w;
+        for (int w; next_neighbour(&in, &w);) sources[in.position - 1] = w;
+    }
+    free_packed_lists(&packed_adj);
+    free_packed_lists(&packed_rev);
+    adj_targets = targets;
+    rev_targets = sources;
+    graph_compressed = false;
+}
+
+// ---------------------------------------------------------------------------
+// Secondary indexes
+//
+// follower_order and activity_order rank every user by followers and by
+// activity, highest first; threshold and range queries are a binary search
+// followed by a contiguous slice, and top-N by one key is a prefix. The
+// country posting lists group users by country code: the users of country c
+// are at [country_postings[c], country_postings[c + 1]) of both
+// country_by_followers and country_by_activity, each sorted highest first.
+// Ties are broken by file order (compare_rows()). When a key changes the
+// rankings are patched in place (set_user_followers / set_user_activity)
+// rather than rebuilt.
+// ---------------------------------------------------------------------------
+
+int *follower_order = NULL;
+int *activity_order = NULL;
+int *country_postings = NULL;
+int *country_by_followers = NULL;
+int *country_by_activity = NULL;
+
+// Comparison function for sorting user indices by followers (descending).
+// Ties keep file order.
+int compareIndicesByFollowers(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    if (user_followers[x] != user_followers[y]) return user_followers[x] < user_followers[y] ? 1 : -1;
+    return compare_rows(x, y);
+}
+
+// Comparison function for sorting user indices by activity score (descending).
+// Ties keep file order.
+int compareIndicesByActivity(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    if (user_activity[x] != user_activity[y]) return user_activity[x] < user_activity[y] ? 1 : -1;
+    return compare_rows(x, y);
+}
+
+// Maps a follower count to a key whose ascending order is descending followers.
+static inline uint32_t follower_sort_key(int followers) {
+    return ~((uint32_t)followers ^ 0x80000000u);
+}
+
+// Maps a score to a key whose ascending order is descending score.
+static inline uint32_t score_sort_key(float score) {
+    uint32_t bits;
+    memcpy(&bits, &score, sizeof(bits));
+    bits = (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+    return ~bits;
+}
+
+// Stable LSD radix sort of user indices by ascending keys[index], one byte per
+// pass. Passes where every key has the same byte are skipped.
+void radix_sort_indices(int *order, int count, const uint32_t *keys) {
+    int *buffer = xmalloc(sizeof(int) * (count ? count : 1));
+    for (int shift = 0; shift < 32; shift += 8) {
+        int histogram[257] = { 0 };
+        for (int i = 0; i < count; i++) histogram[((keys[order[i]] >> shift) & 0xFF) + 1]++;
+        bool trivial = false;
+        for (int b = 1; b <= 256; b++) trivial |= histogram[b] == count;
+        if (trivial) continue;
+        for (int b = 0; b < 256; b++) histogram[b + 1] += histogram[b];
+        for (int i = 0; i < count; i++) buffer[histogram[(keys[order[i]] >> shift) & 0xFF]++] = order[i];
+        memcpy(order, buffer, sizeof(int) * count);
+    }
+    free(buffer);
+}
+
+// Builds follower_order and the per-country posting lists from the user columns.
+void build_secondary_indexes() {
+    INSTRUMENT_SPAN(OP_BUILD_SECONDARY_INDEXES);
+    int n = user_count;
+    uint32_t *keys = xcalloc(n, sizeof(uint32_t));
+    free_owned(follower_order);
+    follower_order = xmalloc(sizeof(int) * (n ? n : 1));
+    for (int i = 0; i < n; i++) {
+        keys[i] = follower_sort_key(user_followers[i]);
+        follower_order[i] = row_user(i);
+    }
+    radix_sort_indices(follower_order, n, keys);
+    free_owned(activity_order);
+    activity_order = xmalloc(sizeof(int) * (n ? n : 1));
+    for (int i = 0; i < n; i++) {
+        keys[i] = score_sort_key(user_activity[i]);
+        activity_order[i] = row_user(i);
+    }
+    radix_sort_indices(activity_order, n, keys);
+    free(keys);
+
+    // Counting sort by country; being stable, it keeps each slice in rank order.
+    free_owned(country_postings);
+    country_postings = xcalloc(countries.count + 1, sizeof(int));
+    for (int i = 0; i < n; i++) country_postings[user_country_ids[i] + 1]++;
+    for (int c = 0; c < countries.count; c++) country_postings[c + 1] += country_postings[c];
+
+    int *cursor = xmalloc(sizeof(int) * (countries.count + 1));
+    free_owned(country_by_followers);
+    country_by_followers = xmalloc(sizeof(int) * (n ? n : 1));
+    memcpy(cursor, country_postings, sizeof(int) * (countries.count + 1));
+    for (int k = 0; k < n; k++) {
+        int u = follower_order[k];
+        country_by_followers[cursor[user_country_ids[u]]++] = u;
+    }
+    free_owned(country_by_activity);
+    country_by_activity = xmalloc(sizeof(int) * (n ? n : 1));
+    memcpy(cursor, country_postings, sizeof(int) * (countries.count + 1));
+    for (int k = 0; k < n; k++) {
+        int u = activity_order[k];
+        country_by_activity[cursor[user_country_ids[u]]++] = u;
+    }
+    free(cursor);
+}
+
+// Returns how many users of a list sorted by followers (highest first) have
+// more than 'threshold' followers; they form its prefix.
+static int followers_above_in(const int *order, int count, int threshold) {
+    int lo = 0, hi = count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (user_followers[order[mid]] > threshold) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Returns how many users have more than 'threshold' followers. They are
+// follower_order[0 .. count - 1], highest first.
+int count_followers_above(int threshold) {
+    return followers_above_in(follower_order, live_user_count(), threshold);
+}
+
+// Finds the users with between 'min' and 'max' followers (inclusive): they are
+// follower_order[*first .. *last - 1], highest first.
+void follower_range(int min, int max, int *first, int *last) {
+    *first = count_followers_above(max);
+    *last = min == INT_MIN ? live_user_count() : count_followers_above(min - 1);
+    if (*last < *first) *last = *first;
+}
+
+// Returns the first position of country 'code' in the posting lists.
+static inline int country_begin(int code) {
+    return country_postings[code];
+}
+
+// Returns one past the last position of country 'code' in the posting lists.
+static inline int country_end(int code) {
+    return country_postings[code + 1];
+}
+
+// qsort-style comparison of two user indices; negative when the first ranks higher.
+typedef int (*IndexCompare)(const void *, const void *);
+
+// Returns the position of user u in 'order' (count users sorted by 'compare').
+// Only valid while u's key still matches its place in the list.
+int ranking_find(const int *order, int count, int u, IndexCompare compare) {
+    int lo = 0, hi = count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (compare(&order[mid], &u) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Inserts user u into 'order' (count users, room for one more).
+void ranking_insert(int *order, int count, int u, IndexCompare compare) {
+    int position = ranking_find(order, count, u, compare);
+    memmove(order + position + 1, order + position, sizeof(int) * (count - position));
+    order[position] = u;
+}
+
+// Removes the entry at 'position' from 'order' (count users).
+void ranking_remove(int *order, int count, int position) {
+    memmove(order + position, order + position + 1, sizeof(int) * (count - position - 1));
+}
+
+// Moves the user at 'position' to its new place after its key changed. Only
+// the entries between the old and new place are shifted.
+void ranking_reposition(int *order, int count, int position, IndexCompare compare) {
+    int u = order[position];
+    if (position > 0 && compare(&u, &order[position - 1]) < 0) {
+        int target = ranking_find(order, position, u, compare);
+        memmove(order + target + 1, order + target, sizeof(int) * (position - target));
+        order[target] = u;
+    } else if (position + 1 < count && compare(&u, &order[position + 1]) > 0) {
+        int target = position + 1 + ranking_find(order + position + 1, count - position - 1, u, compare);
+        memmove(order + position, order + position + 1, sizeof(int) * (target - position - 1));
+        order[target - 1] = u;
+    }
+}
+
+void make_graph_mutable();
+
+// Sets the follower count of user u, keeping follower_order and the country
+// posting list sorted.
+void set_user_followers(int u, int followers) {
+    make_graph_mutable();
+    if (is_user_removed(u)) return;
+    int *local = country_by_followers + country_begin(user_country_ids[u]);
+    int local_count = country_end(user_country_ids[u]) - country_begin(user_country_ids[u]);
+    int global_position = ranking_find(follower_order, live_user_count(), u, compareIndicesByFollowers);
+    int local_position = ranking_find(local, local_count, u, compareIndicesByFollowers);
+    user_followers[u] = followers;
+    ranking_reposition(follower_order, live_user_count(), global_position, compareIndicesByFollowers);
+    ranking_reposition(local, local_count, local_position, compareIndicesByFollowers);
+}
+
+// Sets the activity score of user u, keeping activity_order and the country
+// posting list sorted.
+void set_user_activity(int u, float activity) {
+    make_graph_mutable();
+    if (is_user_removed(u)) return;
+    int *local = country_by_activity + country_begin(user_country_ids[u]);
+    int local_count = country_end(user_country_ids[u]) - country_begin(user_country_ids[u]);
+    int global_position = ranking_find(activity_order, live_user_count(), u, compareIndicesByActivity);
+    int local_position = ranking_find(local, local_count, u, compareIndicesByActivity);
+    user_activity[u] = activity;
+    ranking_reposition(activity_order, live_user_count(), global_position, compareIndicesByActivity);
+    ranking_reposition(local, local_count, local_position, compareIndicesByActivity);
+}
+
+// ---------------------------------------------------------------------------
+// Graph reordering
+//
+// Users are numbered in file order, so a traversal jumps around the user
+// columns and adjacency arrays at random. reorder_graph() renumbers them once
+// after loading so that users that are close in the graph are close in memory:
+//   degree - most connected first (connections plus followers), so the hubs
+//            that most lists point into share a few cache lines;
+//   bfs    - breadth-first order from each remaining hub, so every frontier
+//            is a contiguous range;
+//   rcm    - reverse Cuthill-McKee: breadth-first from a low-degree user,
+//            visiting neighbours by increasing degree, then reversed, which
+//            keeps most connections within a narrow band of indices.
+// Connections are treated as undirected throughout. The user columns and both
+// adjacency directions are permuted together and the indexes rebuilt; user
+// IDs do not change, and user_rows / row_users map between the new order and
+// file order, which still breaks every tie.
+// ---------------------------------------------------------------------------
+
+typedef enum {
+    ORDER_FILE,
+    ORDER_DEGREE,
+    ORDER_BFS,
+    ORDER_RCM,
+    ORDER_COUNT
+} GraphOrder;
+
+const char *graph_order_names[ORDER_COUNT] = { "file", "degree", "bfs", "rcm" };
+GraphOrder graph_order = ORDER_FILE; // order the loaded users are stored in
+
+// Returns the order called 'name', or -1.
+int find_graph_order(const char *name) {
+    for (int o = 0; o < ORDER_COUNT; o++)
+        if (strcasecmp(graph_order_names[o], name) == 0) return o;
+    return -1;
+}
+
+static const int *order_degrees = NULL; // undirected degrees while ordering
+
+// Comparison function for sorting user indices by undirected degree
+// (ascending). Ties keep file order.
+int compareIndicesByDegree(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    if (order_degrees[x] != order_degrees[y]) return order_degrees[x] < order_degrees[y] ? -1 : 1;
+    return compare_rows(x, y);
+}
+
+// Appends to 'queue' the neighbours of u (either direction) that are not yet
+// 'placed', marking them, and returns the new queue length.
+static int enqueue_neighbours(int u, bool *placed, int *queue, int tail) {
+    for (int e = adj_begin(u); e < adj_end(u); e++) {
+        int v = adj_targets[e];
+        if (!placed[v]) {
+            placed[v] = true;
+            queue[tail++] = v;
+        }
+    }
+    for (int e = rev_begin(u); e < rev_end(u); e++) {
+        int v = rev_targets[e];
+        if (!placed[v]) {
+            placed[v] = true;
+            queue[tail++] = v;
+        }
+    }
+    return tail;
+}
+
+// Fills order[0 .. n - 1] with the users in breadth-first order, starting a
+// new search from the first unplaced user of 'starts' whenever one runs dry.
+// With 'by_degree' each user's new neighbours are queued by increasing degree.
+static void breadth_first_order(const int *starts, bool by_degree, int *order) {
+    int n = user_count;
+    bool *placed = xcalloc(n ? n : 1, sizeof(bool));
+    int head = 0, tail = 0;
+    for (int k = 0; k < n; k++) {
+        if (placed[starts[k]]) continue;
+        placed[starts[k]] = true;
+        order[tail++] = starts[k];
+        while (head < tail) {
+            int first = tail;
+            tail = enqueue_neighbours(order[head++], placed, order, tail);
+            if (by_degree) qsort(order + first, tail - first, sizeof(int), compareIndicesByDegree);
+        }
+    }
+    free(placed);
+}
+
+// Replaces the users in place by order[0 .. n - 1] (new index -> old index):
+// permutes the user columns and file rows, rewrites and re-sorts every
+// adjacency list, and rebuilds the reverse adjacency and the hash indexes.
+static void apply_user_order(const int *order) {
+    int n = user_count;
+    int *position = xmalloc(sizeof(int) * (n ? n : 1));
+    for (int k = 0; k < n; k++) position[order[k]] = k;
+
+    int *ids = xmalloc(sizeof(int) * (n ? n : 1));
+    int *followers = xmalloc(sizeof(int) * (n ? n : 1));
+    float *activity = xmalloc(sizeof(float) * (n ? n : 1));
+    uint16_t *country_ids = xmalloc(sizeof(uint16_t) * (n ? n : 1));
+    size_t *name_offsets = xmalloc(sizeof(size_t) * (n ? n : 1));
+    int *rows = xmalloc(sizeof(int) * (n ? n : 1));
+    int *row_index = xmalloc(sizeof(int) * (n ? n : 1));
+    int *offsets = xmalloc(sizeof(int) * (n + 1));
+    int *targets = xmalloc(sizeof(int) * (edge_count ? edge_count : 1));
+    offsets[0] = 0;
+    for (int k = 0; k < n; k++) offsets[k + 1] = offsets[k] + out_degree(order[k]);
+
+    OMP(parallel for schedule(dynamic, 1024))
+    for (int k = 0; k < n; k++) {
+        int u = order[k];
+        ids[k] = user_ids[u];
+        followers[k] = user_followers[u];
+        activity[k] = user_activity[u];
+        country_ids[k] = user_country_ids[u];
+        name_offsets[k] = user_name_offsets[u];
+        rows[k] = user_row(u);
+        int *list = targets + offsets[k];
+        for (int e = adj_begin(u); e < adj_end(u); e++) *list++ = position[adj_targets[e]];
+        qsort(targets + offsets[k], offsets[k + 1] - offsets[k], sizeof(int), compareInts);
+    }
+    for (int k = 0; k < n; k++) row_index[rows[k]] = k;
+
+    free_owned(user_ids);
+    free_owned(user_followers);
+    free_owned(user_activity);
+    free_owned(user_country_ids);
+    free_owned(user_name_offsets);
+    free_owned(user_rows);
+    free_owned(row_users);
+    free_owned(adj_offsets);
+    free_owned(adj_targets);
+    user_ids = ids;
+    user_followers = followers;
+    user_activity = activity;
+    user_country_ids = country_ids;
+    user_name_offsets = name_offsets;
+    user_rows = rows;
+    row_users = row_index;
+    adj_offsets = offsets;
+    adj_targets = targets;
+    free(position);
+
+    build_reverse_graph();
+    build_indexes();
+}
+
+// Renumbers the users of a freshly built graph into 'mode' order. Run after
+// build_graph() and before build_secondary_indexes().
+void reorder_graph(GraphOrder mode) {
+    if (mode == ORDER_FILE) return;
+    INSTRUMENT_SPAN(OP_REORDER);
+    int n = user_count;
+    int *degrees = xmalloc(sizeof(int) * (n ? n : 1));
+    uint32_t *keys = xmalloc(sizeof(uint32_t) * (n ? n : 1));
+    int *starts = xmalloc(sizeof(int) * (n ? n : 1));
+    int *order = xmalloc(sizeof(int) * (n ? n : 1));
+    for (int u = 0; u < n; u++) {
+        degrees[u] = out_degree(u) + in_degree(u);
+        keys[u] = mode == ORDER_RCM ? (uint32_t)degrees[u] : ~(uint32_t)degrees[u]; // RCM starts at the least connected
+        starts[u] = row_user(u);
+    }
+    radix_sort_indices(starts, n, keys);
+    free(keys);
+
+    order_degrees = degrees;
+    if (mode == ORDER_DEGREE) {
+        memcpy(order, starts, sizeof(int) * n);
+    } else {
+        breadth_first_order(starts, mode == ORDER_RCM, order);
+    }
+    if (mode == ORDER_RCM) {
+        for (int k = 0; k < n / 2; k++) {
+            int t = order[k];
+            order[k] = order[n - 1 - k];
+            order[n - 1 - k] = t;
+        }
+    }
+    order_degrees = NULL;
+
+    apply_user_order(order);
+    graph_order = mode;
+    free(order);
+    free(starts);
+    free(degrees);
+}
+
+// ---------------------------------------------------------------------------
+// Influence scores (PageRank)
+//
+// pagerank[u] is the share of time a random walk spends at user u when it
+// follows a random connection with probability PAGERANK_DAMPING and otherwise
+// jumps to a random user (users without connections always jump). It is
+// computed by pull-style power iteration over the reverse adjacency: every
+// sweep, each user sums score / out-degree over the users that list it, in
+// parallel and without atomics, until the scores change by less than
+// PAGERANK_TOLERANCE in total. Sums are reduced in fixed blocks, so the scores
+// do not depend on the thread count. Graph mutations only mark the scores
+// stale; the next computation starts from the previous scores, which after a
+// small change converges in a few sweeps. pagerank_order and
+// country_by_pagerank rank users like follower_order and country_by_followers.
+//
+// Personalized PageRank, where every jump returns to one source user, is
+// approximated by forward push: a user's residual mass is only pushed on to
+// its connections while it exceeds PPR_EPSILON per connection, so a query
+// touches the source's neighbourhood instead of the whole graph.
+// ---------------------------------------------------------------------------
+
+#define PAGERANK_DAMPING 0.85
+#define PAGERANK_TOLERANCE 1e-6
+#define PAGERANK_MAX_ITERATIONS 100
+#define PAGERANK_BLOCK 4096
+#define PPR_EPSILON 1e-5
+
+float *pagerank = NULL;          // score of each user; the scores of live users sum to 1
+int pagerank_users = 0;          // users that have a score
+int *pagerank_order = NULL;      // live users, highest score first
+int *country_by_pagerank = NULL; // pagerank_order grouped by country, like country_by_followers
+bool pagerank_valid = false;
+int pagerank_iterations = 0;     // sweeps run by the last computation
+double pagerank_change = 0.0;    // total score change in its last sweep
+
+// Comparison function for sorting user indices by PageRank (descending).
+// Ties keep file order.
+int compareIndicesByPagerank(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    if (pagerank[x] != pagerank[y]) return pagerank[x] < pagerank[y] ? 1 : -1;
+    return compare_rows(x, y);
+}
+
+// Computes the PageRank of every user and ranks them, unless the scores are
+// current. Starts from the previous scores if there are any.
+void compute_pagerank() {
+    if (pagerank_valid) return;
+    INSTRUMENT_SPAN(OP_PAGERANK);
+    int n = user_count, live = live_user_count();
+    int blocks = (n + PAGERANK_BLOCK - 1) / PAGERANK_BLOCK;
+    double *score = xmalloc(sizeof(double) * (n ? n : 1));
+    double *contribution = xmalloc(sizeof(double) * (n ? n : 1));
+    double *partial = xmalloc(sizeof(double) * (blocks ? blocks : 1));
+
+    // Users added since the last computation start at the average score.
+    double total = 0.0;
+    for (int u = 0; u < n; u++) {
+        score[u] = is_user_removed(u) ? 0.0 : u < pagerank_users ? pagerank[u] : 1.0 / live;
+        total += score[u];
+    }
+    for (int u = 0; u < n; u++) {
+        if (total > 0.0) score[u] /= total;
+        else if (!is_user_removed(u)) score[u] = 1.0 / live;
+    }
+
+    pagerank_iterations = 0;
+    pagerank_change = 0.0;
+    while (live > 0 && pagerank_iterations < PAGERANK_MAX_ITERATIONS) {
+        OMP(parallel for schedule(static))
+        for (int b = 0; b < blocks; b++) {
+            int end = b == blocks - 1 ? n : (b + 1) * PAGERANK_BLOCK;
+            double dangling = 0.0;
+            for (int u = b * PAGERANK_BLOCK; u < end; u++) {
+                int degree = out_degree(u);
+                contribution[u] = degree > 0 ? score[u] / degree : 0.0;
+                if (degree == 0) dangling += score[u];
+            }
+            partial[b] = dangling;
+        }
+        double dangling = 0.0;
+        for (int b = 0; b < blocks; b++) dangling += partial[b];
+        double base = (1.0 - PAGERANK_DAMPING + PAGERANK_DAMPING * dangling) / live;
+
+        // Reads only 'contribution', so scores can be replaced in place.
+        OMP(parallel for schedule(dynamic, 1))
+        for (int b = 0; b < blocks; b++) {
+            int end = b == blocks - 1 ? n : (b + 1) * PAGERANK_BLOCK;
+            double change = 0.0;
+#ifdef INSTRUMENT
+            uint64_t scanned = 0;
+#endif
+            for (int v = b * PAGERANK_BLOCK; v < end; v++) {
+                if (is_user_removed(v)) continue;
+                double sum = 0.0;
+                NeighbourCursor cursor = in_neighbours(v);
+                for (int u; next_neighbour(&cursor, &u);) sum += contribution[u];
+                double next = base + PAGERANK_DAMPING * sum;
+                change += fabs(next - score[v]);
+                score[v] = next;
+#ifdef INSTRUMENT
+                scanned += in_degree(v);
+#endif
+            }
+            INSTRUMENT_COUNT(COUNTER_EDGES_SCANNED, scanned);
+            partial[b] = change;
+        }
+        pagerank_change = 0.0;
+        for (int b = 0; b < blocks; b++) pagerank_change += partial[b];
+        pagerank_iterations++;
+        if (pagerank_change < PAGERANK_TOLERANCE) break;
+    }
+
+    free(pagerank);
+    pagerank = xmalloc(sizeof(float) * (n ? n : 1));
+    uint32_t *keys = xmalloc(sizeof(uint32_t) * (n ? n : 1));
+    free(pagerank_order);
+    pagerank_order = xmalloc(sizeof(int) * (n ? n : 1));
+    int ranked = 0;
+    for (int u = 0; u < n; u++) {
+        pagerank[u] = (float)score[u];
+        keys[u] = score_sort_key(pagerank[u]);
+    }
+    for (int r = 0; r < n; r++) {
+        if (!is_user_removed(row_user(r))) pagerank_order[ranked++] = row_user(r);
+    }
+    pagerank_users = n;
+    radix_sort_indices(pagerank_order, ranked, keys);
+
+    int *cursor = xmalloc(sizeof(int) * (countries.count + 1));
+    free(country_by_pagerank);
+    country_by_pagerank = xmalloc(sizeof(int) * (n ? n : 1));
+    memcpy(cursor, country_postings, sizeof(int) * (countries.count + 1));
+    for (int k = 0; k < ranked; k++) {
+        int u = pagerank_order[k];
+        country_by_pagerank[cursor[user_country_ids[u]]++] = u;
+    }
+    free(cursor);
+    free(keys);
+    free(partial);
+    free(contribution);
+    free(score);
+    pagerank_valid = true;
+}
+
+// Returns the 1-based PageRank position of live user u.
+int pagerank_rank(int u) {
+    compute_pagerank();
+    return ranking_find(pagerank_order, live_user_count(), u, compareIndicesByPagerank) + 1;
+}
+
+// One user with a score.
+typedef struct {
+    int user;
+    double score;
+} ScoredUser;
+
+// Reusable per-thread buffers for personalized PageRank queries.
+typedef struct {
+    double *estimate; // approximate personalized score of each user
+    double *residual; // mass not yet pushed on
+    bool *queued;
+    int *queue;       // circular, capacity + 1 entries; users whose residual is worth pushing
+    int *touched;     // users with a non-zero estimate or residual
+    int capacity;
+} PushWorkspace;
+
+// Makes sure the workspace can hold 'n' users.
+void push_workspace_reserve(PushWorkspace *ws, int n) {
+    if (ws->capacity >= n) return;
+    free(ws->estimate);
+    free(ws->residual);
+    free(ws->queued);
+    free(ws->queue);
+    free(ws->touched);
+    ws->estimate = xcalloc(n, sizeof(double));
+    ws->residual = xcalloc(n, sizeof(double));
+    ws->queued = xcalloc(n, sizeof(bool));
+    ws->queue = xmalloc(sizeof(int) * (n + 1));
+    ws->touched = xmalloc(sizeof(int) * n);
+    ws->capacity = n;
+}
+
+// Releases the workspace buffers.
+void push_workspace_free(PushWorkspace *ws) {
+    free(ws->estimate);
+    free(ws->residual);
+    free(ws->queued);
+    free(ws->queue);
+    free(ws->touched);
+    memset(ws, 0, sizeof(*ws));
+}
+
+// Returns true if a ranks above b (higher score, then earlier in the file).
+static inline bool scored_better(const ScoredUser *a, const ScoredUser *b) {
+    if (a->score != b->score) return a->score > b->score;
+    return compare_rows(a->user, b->user) < 0;
+}
+
+// Restores the min-heap property (worst user at the root) below 'i'.
+static void scored_sift_down(ScoredUser *heap, int size, int i) {
+    while (true) {
+        int worst = i, left = 2 * i + 1, right = left + 1;
+        if (left < size && scored_better(&heap[worst], &heap[left])) worst = left;
+        if (right < size && scored_better(&heap[worst], &heap[right])) worst = right;
+        if (worst == i) return;
+        ScoredUser tmp = heap[i];
+        heap[i] = heap[worst];
+        heap[worst] = tmp;
+        i = worst;
+    }
+}
+
+// Approximates the personalized PageRank of user index 'source' and writes the
+// k highest-scoring other users to 'out', best first. Each score is
+// underestimated by at most PPR_EPSILON times the user's connection count.
+// Returns the number of users written.
+int personalized_pagerank(PushWorkspace *ws, int source, int k, ScoredUser *out) {
+    INSTRUMENT_SPAN(OP_PERSONALIZED_PAGERANK);
+    int n = user_count;
+    push_workspace_reserve(ws, n);
+    double *estimate = ws->estimate, *residual = ws->residual;
+    int touched = 0, head = 0, tail = 0;
+
+    residual[source] = 1.0;
+    ws->touched[touched++] = source;
+    ws->queue[tail++] = source;
+    ws->queued[source] = true;
+    while (head != tail) {
+        int u = ws->queue[head];
+        head = head == n ? 0 : head + 1;
+        ws->queued[u] = false;
+        int degree = out_degree(u);
+        double mass = residual[u];
+        residual[u] = 0.0;
+        estimate[u] += (1.0 - PAGERANK_DAMPING) * mass;
+        mass *= PAGERANK_DAMPING;
+
+        // A user without connections jumps back to the source.
+        NeighbourCursor cursor = out_neighbours(u);
+        if (degree > 0) mass /= degree;
+        INSTRUMENT_COUNT(COUNTER_EDGES_SCANNED, degree > 0 ? degree : 1);
+        int v = source;
+        for (bool more = degree == 0 || next_neighbour(&cursor, &v); more; more = degree > 0 && next_neighbour(&cursor, &v)) {
+            if (estimate[v] == 0.0 && residual[v] == 0.0) ws->touched[touched++] = v;
+            residual[v] += mass;
+            int v_degree = out_degree(v);
+            if (!ws->queued[v] && residual[v] > PPR_EPSILON * (v_degree > 0 ? v_degree : 1)) {
+                ws->queue[tail] = v;
+                tail = tail == n ? 0 : tail + 1;
+                ws->queued[v] = true;
+            }
+        }
+    }
+
+    INSTRUMENT_COUNT(COUNTER_VERTICES_VISITED, touched);
+    int size = 0;
+    for (int t = 0; t < touched; t++) {
+        int v = ws->touched[t];
+        ScoredUser s = { v, estimate[v] };
+        estimate[v] = residual[v] = 0.0;
+        if (v == source || s.score == 0.0 || k <= 0) continue;
+        if (size < k) {
+            out[size++] = s;
+            if (size == k) {
+                for (int i = k / 2 - 1; i >= 0; i--) scored_sift_down(out, size, i);
+            }
+        } else if (scored_better(&s, &out[0])) {
+            out[0] = s;
+            scored_sift_down(out, size, 0);
+        }
+    }
+
+    // Sort the kept users best first (insertion sort; k is small).
+    for (int i = 1; i < size; i++) {
+        ScoredUser s = out[i];
+        int j = i - 1;
+        for (; j >= 0 && scored_better(&s, &out[j]); j--) out[j + 1] = out[j];
+        out[j + 1] = s;
+    }
+    return size;
+}
+
+// ---------------------------------------------------------------------------
+// Communities
+//
+// Users are grouped by label propagation, ignoring the direction of
+// connections: every user starts in a community of its own and repeatedly
+// joins the community most common among its connections and followers
+// (keeping its own on a tie), until almost nobody moves. Users are processed
+// in fixed blocks in parallel; inside a block labels change in place, across
+// blocks the previous sweep's labels are read, so the result does not depend
+// on the thread count. Each user also sits out a pseudo-random half of the
+// sweeps, which breaks the flip-flops of pairs that would otherwise swap
+// labels forever. Communities are numbered in order of their lowest user
+// index; community_postings and community_by_followers list the users of each
+// community highest followers first, like the country posting lists.
+// ---------------------------------------------------------------------------
+
+#define COMMUNITY_MAX_ITERATIONS 30
+#define COMMUNITY_BLOCK 256
+#define COMMUNITY_MOVE_RATIO 1000 // stop once fewer than one user in this many moves
+
+int *community_id = NULL;           // community of each user, -1 for removed users
+int *community_postings = NULL;     // community c is community_by_followers[postings[c] .. postings[c + 1])
+int *community_by_followers = NULL;
+int community_count = 0;
+int community_iterations = 0;       // sweeps run by the last computation
+bool communities_valid = false;
+
+// Returns true if user u keeps its label during the given sweep.
+static inline bool community_sits_out(int u, int iteration) {
+    uint32_t h = hash_id(u) ^ (uint32_t)(iteration + 1) * 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h & 1;
+}
+
+// One slot of the label-count table of community_best_label().
+typedef struct {
+    int label; // -1 for an empty slot
+    int count;
+} LabelCount;
+
+// Returns the number of label-count slots used for a user with 'degree'
+// connections and followers: a power of two at least twice the degree.
+static inline size_t label_table_size(int degree) {
+    size_t size = 2;
+    while (size < 2 * (size_t)degree) size <<= 1;
+    return size;
+}
+
+// Returns the label most common among the neighbours of u, keeping u's own
+// label on a tie and otherwise preferring the lowest label. The labels are
+// counted in 'table', an open-addressing table of label_table_size(degree of
+// u) slots, so the scratch a thread needs grows with the highest degree
+// rather than the user count; 'touched' (room for u's degree) records the
+// slots used, which are emptied again. Neighbours in u's own block are read
+// from 'labels', others from 'previous'.
+static int community_best_label(int u, const int *labels, const int *previous, LabelCount *table, int *touched) {
+    int block = u / COMMUNITY_BLOCK, touched_count = 0;
+    size_t mask = label_table_size(out_degree(u) + in_degree(u)) - 1;
+    for (int pass = 0; pass < 2; pass++) {
+        NeighbourCursor cursor = pass ? in_neighbours(u) : out_neighbours(u);
+        for (int w; next_neighbour(&cursor, &w);) {
+            int label = w / COMMUNITY_BLOCK == block ? labels[w] : previous[w];
+            size_t slot = hash_id(label) & mask;
+            while (table[slot].label != label && table[slot].label != -1) slot = (slot + 1) & mask;
+            if (table[slot].label == -1) {
+                table[slot].label = label;
+                touched[touched_count++] = (int)slot;
+            }
+            table[slot].count++;
+        }
+    }
+    int own = labels[u], own_count = 0, best = own, best_count = 0;
+    for (int t = 0; t < touched_count; t++) {
+        int slot = touched[t], label = table[slot].label, label_count = table[slot].count;
+        table[slot] = (LabelCount){ -1, 0 };
+        if (label == own) {
+            own_count = label_count;
+        } else if (label_count > best_count || (label_count == best_count && label < best)) {
+            best = label;
+            best_count = label_count;
+        }
+    }
+    return own_count >= best_count ? own : best;
+}
+
+// Detects communities unless they are current.
+void compute_communities() {
+    if (communities_valid) return;
+    INSTRUMENT_SPAN(OP_COMMUNITIES);
+    int n = user_count;
+    int blocks = (n + COMMUNITY_BLOCK - 1) / COMMUNITY_BLOCK;
+    int *labels = xmalloc(sizeof(int) * (n ? n : 1));
+    int *previous = xmalloc(sizeof(int) * (n ? n : 1));
+    int *moves = xmalloc(sizeof(int) * (blocks ? blocks : 1));
+    for (int u = 0; u < n; u++) labels[u] = u;
+
+    // Per-thread label-count tables sized for the highest degree, allocated
+    // once; community_best_label() leaves them empty for the next user.
+    int threads = 1, max_degree = 0;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    for (int u = 0; u < n; u++) {
+        int degree = out_degree(u) + in_degree(u);
+        if (degree > max_degree) max_degree = degree;
+    }
+    size_t stride = label_table_size(max_degree);
+    LabelCount *tables = xmalloc(sizeof(LabelCount) * (size_t)threads * stride);
+    for (size_t i = 0; i < (size_t)threads * stride; i++) tables[i] = (LabelCount){ -1, 0 };
+    int *touched_lists = xmalloc(sizeof(int) * (size_t)threads * (max_degree + 1));
+
+    community_iterations = 0;
+    while (community_iterations < COMMUNITY_MAX_ITERATIONS) {
+        int iteration = community_iterations++;
+        memcpy(previous, labels, sizeof(int) * n);
+        OMP(parallel)
+        {
+            int thread = 0;
+#ifdef _OPENMP
+            thread = omp_get_thread_num();
+#endif
+            LabelCount *table = tables + (size_t)thread * stride;
+            int *touched = touched_lists + (size_t)thread * (max_degree + 1);
+            OMP(for schedule(dynamic, 1))
+            for (int b = 0; b < blocks; b++) {
+                int end = b == blocks - 1 ? n : (b + 1) * COMMUNITY_BLOCK;
+                moves[b] = 0;
+#ifdef INSTRUMENT
+                uint64_t scanned = 0;
+#endif
+                for (int u = b * COMMUNITY_BLOCK; u < end; u++) {
+                    if (is_user_removed(u) || community_sits_out(u, iteration)) continue;
+                    int label = community_best_label(u, labels, previous, table, touched);
+                    moves[b] += label != labels[u];
+                    labels[u] = label;
+#ifdef INSTRUMENT
+                    scanned += out_degree(u) + in_degree(u);
+#endif
+                }
+                INSTRUMENT_COUNT(COUNTER_EDGES_SCANNED, scanned);
+            }
+        }
+        long long moved = 0;
+        for (int b = 0; b < blocks; b++) moved += moves[b];
+        if (moved * COMMUNITY_MOVE_RATIO < n) break;
+    }
+    free(touched_lists);
+    free(tables);
+
+    // Number the communities by their lowest user index.
+    int *number = previous;
+    for (int u = 0; u < n; u++) number[u] = -1;
+    free(community_id);
+    community_id = xmalloc(sizeof(int) * (n ? n : 1));
+    community_count = 0;
+    for (int u = 0; u < n; u++) {
+        if (is_user_removed(u)) {
+            community_id[u] = -1;
+            continue;
+        }
+        if (number[labels[u]] < 0) number[labels[u]] = community_count++;
+        community_id[u] = number[labels[u]];
+    }
+
+    // Counting sort of the follower ranking; being stable, it keeps each
+    // community in follower order.
+    free(community_postings);
+    community_postings = xcalloc(community_count + 1, sizeof(int));
+    for (int u = 0; u < n; u++) {
+        if (community_id[u] >= 0) community_postings[community_id[u] + 1]++;
+    }
+    for (int c = 0; c < community_count; c++) community_postings[c + 1] += community_postings[c];
+    int *cursor = labels;
+    memcpy(cursor, community_postings, sizeof(int) * community_count);
+    free(community_by_followers);
+    community_by_followers = xmalloc(sizeof(int) * (n ? n : 1));
+    for (int k = 0, live = live_user_count(); k < live; k++) {
+        int u = follower_order[k];
+        community_by_followers[cursor[community_id[u]]++] = u;
+    }
+    free(moves);
+    free(previous);
+    free(labels);
+    communities_valid = true;
+}
+
+// Returns the first position of community c in community_by_followers.
+static inline int community_begin(int c) {
+    return community_postings[c];
+}
+
+// Returns one past the last position of community c in community_by_followers.
+static inline int community_end(int c) {
+    return community_postings[c + 1];
+}
+
+// ---------------------------------------------------------------------------
+// Top-N influencer queries
+//
+// A query ranks by one key and may restrict to a country, a community and to
+// users above a follower floor. Whenever the candidates come out of an index
+// already in rank order the answer is a prefix walk; otherwise (activity or
+// PageRank above a follower floor, or within a community) the candidates are
+// a follower-ordered slice and the best N are picked with a bounded heap,
+// O(k log N) instead of a full sort.
+// ---------------------------------------------------------------------------
+
+typedef enum {
+    RANK_BY_FOLLOWERS,
+    RANK_BY_ACTIVITY,
+    RANK_BY_PAGERANK // computed on first use, see compute_pagerank()
+} RankKey;
+
+typedef struct {
+    RankKey key;
+    int country;       // interned country code, or -1 for every country
+    int min_followers; // only users with more than this many followers; INT_MIN for no floor
+    int community;     // community id (see compute_communities()), or -1 for every community
+} TopNQuery;
+
+// Restores the heap property below position i of a heap whose root is the
+// lowest-ranked entry.
+static void top_n_sift_down(int *heap, int size, int i, IndexCompare compare) {
+    while (true) {
+        int worst = i, left = 2 * i + 1, right = left + 1;
+        if (left < size && compare(&heap[left], &heap[worst]) > 0) worst = left;
+        if (right < size && compare(&heap[right], &heap[worst]) > 0) worst = right;
+        if (worst == i) return;
+        int tmp = heap[i]; heap[i] = heap[worst]; heap[worst] = tmp;
+        i = worst;
+    }
+}
+
+// Writes the n highest-ranked of 'candidates' to 'out', best first, using a
+// bounded heap. Returns how many were written (at most n).
+int select_top_n(const int *candidates, int count, int n, IndexCompare compare, int *out) {
+    int size = 0;
+    if (n <= 0) return 0;
+    for (int k = 0; k < count; k++) {
+        int u = candidates[k];
+        if (size < n) {
+            out[size++] = u;
+            for (int i = size - 1; i > 0 && compare(&out[(i - 1) / 2], &out[i]) < 0; i = (i - 1) / 2) {
+                int tmp = out[i]; out[i] = out[(i - 1) / 2]; out[(i - 1) / 2] = tmp;
+            }
+        } else if (compare(&u, &out[0]) < 0) {
+            out[0] = u;
+            top_n_sift_down(out, size, 0, compare);
+        }
+    }
+    qsort(out, size, sizeof(int), compare);
+    return size;
+}
+
+// Answers a top-N query within one community. Its users are already in
+// follower order, so they are filtered by country and follower floor in one
+// pass and then ranked by the key.
+static int top_n_in_community(const TopNQuery *query, int n, int *out) {
+    compute_communities();
+    if (query->community >= community_count) return 0;
+    const int *members = community_by_followers + community_begin(query->community);
+    int count = community_end(query->community) - community_begin(query->community);
+    int *candidates = xmalloc(sizeof(int) * (count ? count : 1));
+    int eligible = 0;
+    for (int k = 0; k < count; k++) {
+        int u = members[k];
+        if (query->min_followers != INT_MIN && user_followers[u] <= query->min_followers) break;
+        if (query->country < 0 || user_country_ids[u] == query->country) candidates[eligible++] = u;
+    }
+    int found;
+    if (query->key == RANK_BY_FOLLOWERS) {
+        found = eligible < n ? eligible : n;
+        memcpy(out, candidates, sizeof(int) * (found > 0 ? found : 0));
+    } else {
+        if (query->key == RANK_BY_PAGERANK) compute_pagerank();
+        found = select_top_n(candidates, eligible, n, query->key == RANK_BY_ACTIVITY ? compareIndicesByActivity : compareIndicesByPagerank, out);
+    }
+    free(candidates);
+    return found;
+}
+
+// Answers a top-N query into 'out' (room for n users), best first. Returns how
+// many users matched (at most n).
+int top_n_influencers(const TopNQuery *query, int n, int *out) {
+    INSTRUMENT_SPAN(OP_TOP_N);
+    if (query->community >= 0) return top_n_in_community(query, n, out);
+    const int *by_followers = follower_order, *by_key;
+    int count = live_user_count();
+    if (query->country >= 0) {
+        by_followers = country_by_followers + country_begin(query->country);
+        count = country_end(query->country) - country_begin(query->country);
+    }
+    by_key = by_followers;
+    IndexCompare compare = compareIndicesByFollowers;
+    if (query->key == RANK_BY_ACTIVITY) {
+        by_key = query->country >= 0 ? country_by_activity + country_begin(query->country) : activity_order;
+        compare = compareIndicesByActivity;
+    } else if (query->key == RANK_BY_PAGERANK) {
+        compute_pagerank();
+        by_key = query->country >= 0 ? country_by_pagerank + country_begin(query->country) : pagerank_order;
+        compare = compareIndicesByPagerank;
+    }
+    int eligible = query->min_followers == INT_MIN ? count : followers_above_in(by_followers, count, query->min_followers);
+
+    if (query->key == RANK_BY_FOLLOWERS || eligible == count) {
+        if (query->key == RANK_BY_FOLLOWERS) count = eligible;
+        int found = count < n ? count : n;
+        memcpy(out, by_key, sizeof(int) * (found > 0 ? found : 0));
+        return found;
+    }
+
+    // Activity or PageRank above a follower floor. Walking the key's ranking
+    // costs about n * count / eligible steps; the heap costs eligible * log n.
+    if ((double)eligible * log2(n + 1.0) < (double)n * count / (eligible + 1.0))
+        return select_top_n(by_followers, eligible, n, compare, out);
+    int found = 0;
+    for (int k = 0; k < count && found < n; k++) {
+        if (user_followers[by_key[k]] > query->min_followers) out[found++] = by_key[k];
+    }
+    return found;
+}
+
+// ---------------------------------------------------------------------------
+// Binary graph snapshots
+//
+// A snapshot holds everything needed to answer queries: the user columns, the
+// interned country table, an interned string table, the forward and reverse
+// CSR adjacency, the ID / name indexes, the ranking / country secondary
+// indexes and, for a reordered graph, the maps to and from file rows. Each
+// section is 64-byte aligned so load_snapshot() can map the file and point
+// the global arrays straight into it without parsing or rebuilding anything.
+// ---------------------------------------------------------------------------
+
+#define SNAPSHOT_MAGIC "SOCGRAPH"
+#define SNAPSHOT_VERSION 6
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+#define SNAPSHOT_ALIGNMENT 64
+
+enum {
+    SECTION_USER_IDS,
+    SECTION_USER_FOLLOWERS,
+    SECTION_USER_ACTIVITY,
+    SECTION_USER_COUNTRIES,
+    SECTION_USER_NAMES,
+    SECTION_STRINGS,
+    SECTION_COUNTRY_NAMES,
+    SECTION_COUNTRY_INDEX,
+    SECTION_ADJ_OFFSETS,
+    SECTION_ADJ_TARGETS,
+    SECTION_ID_INDEX,
+    SECTION_NAME_INDEX,
+    SECTION_NAME_NEXT,
+    SECTION_REV_OFFSETS,
+    SECTION_REV_TARGETS,
+    SECTION_FOLLOWER_ORDER,
+    SECTION_ACTIVITY_ORDER,
+    SECTION_COUNTRY_POSTINGS,
+    SECTION_COUNTRY_BY_FOLLOWERS,
+    SECTION_COUNTRY_BY_ACTIVITY,
+    SECTION_USER_ROWS,
+    SECTION_ROW_USERS,
+    SECTION_COUNT
+};
+
+typedef struct {
+    uint64_t offset;
+    uint64_t size;
+    uint64_t checksum;
+} SnapshotSection;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;      // SNAPSHOT_BYTE_ORDER as seen by the writer
+    uint32_t size_t_size;     // sizeof(size_t) on the writer
+    int32_t user_count;
+    int32_t edge_count;
+    int32_t country_count;
+    uint32_t country_index_size; // slots in the country index
+    uint32_t id_index_size;   // slots in the ID index
+    uint32_t name_index_size; // slots in the name index
+    uint32_t graph_order;     // GraphOrder of the users; the row maps are empty for ORDER_FILE
+    SnapshotSection sections[SECTION_COUNT];
+    uint64_t header_checksum; // checksum of every header byte before this field
+} SnapshotHeader;
+
+// Computes a 64-bit checksum of a block of memory, eight bytes at a time.
+uint64_t checksum64(const void *data, size_t size) {
+    const unsigned char *p = data;
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ size;
+    for (; size >= 8; p += 8, size -= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        h = (h ^ word) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 29;
+    }
+    for (; size > 0; p++, size--) {
+        h = (h ^ *p) * 0x100000001B3ull;
+    }
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    return h ^ (h >> 33);
+}
+
+// Exact-match string interning used while writing a snapshot. Returns the
+// offset of 'str' in the growing string table, appending it on first use.
+typedef struct {
+    char *data;
+    size_t size, capacity;
+    uint64_t *slots; // (offset + 1), 0 marks an empty slot
+    uint32_t mask;
+} StringTable;
+
+size_t intern_string(StringTable *table, const char *str) {
+    size_t length = strlen(str);
+    uint32_t h = (uint32_t)checksum64(str, length);
+    uint32_t s = h & table->mask;
+    for (; table->slots[s] != 0; s = (s + 1) & table->mask) {
+        const char *existing = table->data + (table->slots[s] - 1);
+        if (strcmp(existing, str) == 0) return (size_t)(table->slots[s] - 1);
+    }
+    if (table->size + length + 1 > table->capacity) {
+        while (table->size + length + 1 > table->capacity)
+            table->capacity = table->capacity ? table->capacity * 2 : 4096;
+        table->data = xrealloc(table->data, table->capacity);
+    }
+    size_t offset = table->size;
+    memcpy(table->data + offset, str, length + 1);
+    table->size += length + 1;
+    table->slots[s] = (uint64_t)offset + 1;
+    return offset;
+}
+
+// Writes one section at the next aligned file position and records it in the header.
+void write_section(FILE *file, SnapshotHeader *header, int section, const void *data, size_t size) {
+    static const char padding[SNAPSHOT_ALIGNMENT] = { 0 };
+    long position = ftell(file);
+    long aligned = (position + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+    if (position < 0 || fwrite(padding, 1, (size_t)(aligned - position), file) != (size_t)(aligned - position) ||
+        (size > 0 && fwrite(data, 1, size, file) != size)) {
+        printf("Error writing snapshot!\n");
+        exit(1);
+    }
+    header->sections[section].offset = (uint64_t)aligned;
+    header->sections[section].size = size;
+    header->sections[section].checksum = checksum64(data, size);
+}
+
+void compact_graph();
+
+// Writes the loaded graph (user columns, strings, adjacency and indexes) to a
+// snapshot file. A mutated graph is compacted back into packed form first.
+void save_snapshot(const char *filename) {
+    INSTRUMENT_SPAN(OP_SAVE_SNAPSHOT);
+    compact_graph();
+    decompress_graph();
+    FILE *file = fopen(filename, "wb");
+    if (!file) {
+        printf("Error creating snapshot file!\n");
+        exit(1);
+    }
+
+    // Re-point names and countries into a compact table of distinct strings.
+    StringTable strings = { 0 };
+    strings.mask = index_table_size(user_count * 2) - 1;
+    strings.slots = xcalloc((size_t)strings.mask + 1, sizeof(uint64_t));
+    size_t *name_offsets = xmalloc(sizeof(size_t) * (user_count ? user_count : 1));
+    for (int i = 0; i < user_count; i++)
+        name_offsets[i] = intern_string(&strings, user_name(i));
+    size_t *country_offsets = xmalloc(sizeof(size_t) * (countries.count ? countries.count : 1));
+    for (int c = 0; c < countries.count; c++)
+        country_offsets[c] = intern_string(&strings, country_name(c));
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, 8);
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.size_t_size = sizeof(size_t);
+    header.user_count = user_count;
+    header.edge_count = edge_count;
+    header.country_count = countries.count;
+    header.country_index_size = countries.slots ? countries.mask + 1 : 0;
+    header.id_index_size = id_index_mask + 1;
+    header.name_index_size = name_index_mask + 1;
+    header.graph_order = user_rows ? graph_order : ORDER_FILE;
+    fwrite(&header, sizeof(header), 1, file);
+
+    write_section(file, &header, SECTION_USER_IDS, user_ids, sizeof(int) * user_count);
+    write_section(file, &header, SECTION_USER_FOLLOWERS, user_followers, sizeof(int) * user_count);
+    write_section(file, &header, SECTION_USER_ACTIVITY, user_activity, sizeof(float) * user_count);
+    write_section(file, &header, SECTION_USER_COUNTRIES, user_country_ids, sizeof(uint16_t) * user_count);
+    write_section(file, &header, SECTION_USER_NAMES, name_offsets, sizeof(size_t) * user_count);
+    write_section(file, &header, SECTION_STRINGS, strings.data, strings.size);
+    write_section(file, &header, SECTION_COUNTRY_NAMES, country_offsets, sizeof(size_t) * countries.count);
+    write_section(file, &header, SECTION_COUNTRY_INDEX, countries.slots, sizeof(NameSlot) * header.country_index_size);
+    write_section(file, &header, SECTION_ADJ_OFFSETS, adj_offsets, sizeof(int) * (user_count + 1));
+    write_section(file, &header, SECTION_ADJ_TARGETS, adj_targets, sizeof(int) * edge_count);
+    write_section(file, &header, SECTION_ID_INDEX, id_index, sizeof(IdSlot) * header.id_index_size);
+    write_section(file, &header, SECTION_NAME_INDEX, name_index, sizeof(NameSlot) * header.name_index_size);
+    write_section(file, &header, SECTION_NAME_NEXT, name_next, sizeof(int) * user_count);
+    write_section(file, &header, SECTION_REV_OFFSETS, rev_offsets, sizeof(int) * (user_count + 1));
+    write_section(file, &header, SECTION_REV_TARGETS, rev_targets, sizeof(int) * edge_count);
+    write_section(file, &header, SECTION_FOLLOWER_ORDER, follower_order, sizeof(int) * user_count);
+    write_section(file, &header, SECTION_ACTIVITY_ORDER, activity_order, sizeof(int) * user_count);
+    write_section(file, &header, SECTION_COUNTRY_POSTINGS, country_postings, sizeof(int) * (countries.count + 1));
+    write_section(file, &header, SECTION_COUNTRY_BY_FOLLOWERS, country_by_followers, sizeof(int) * user_count);
+    write_section(file, &header, SECTION_COUNTRY_BY_ACTIVITY, country_by_activity, sizeof(int) * user_count);
+    write_section(file, &header, SECTION_USER_ROWS, user_rows, user_rows ? sizeof(int) * user_count : 0);
+    write_section(file, &header, SECTION_ROW_USERS, row_users, user_rows ? sizeof(int) * user_count : 0);
+    // A zero block at the end keeps even an empty last section inside the
+    // mapping, where in_snapshot() recognizes it.
+    static const char tail[SNAPSHOT_ALIGNMENT] = { 0 };
+    if (fwrite(tail, 1, sizeof(tail), file) != sizeof(tail)) {
+        printf("Error writing snapshot!\n");
+        exit(1);
+    }
+
+    header.header_checksum = checksum64(&header, offsetof(SnapshotHeader, header_checksum));
+    fseek(file, 0, SEEK_SET);
+    if (fwrite(&header, sizeof(header), 1, file) != 1 || fclose(file) != 0) {
+        printf("Error writing snapshot!\n");
+        exit(1);
+    }
+
+    free(country_offsets);
+    free(name_offsets);
+    free(strings.slots);
+    free(strings.data);
+}
+
+// Returns true if the file starts with the snapshot magic bytes.
+bool is_snapshot_file(const char *filename) {
+    char magic[8];
+    FILE *file = fopen(filename, "rb");
+    if (!file) return false;
+    bool match = fread(magic, 1, 8, file) == 8 && memcmp(magic, SNAPSHOT_MAGIC, 8) == 0;
+    fclose(file);
+    return match;
+}
+
+// Maps a snapshot and points the global user, string, adjacency and index
+// arrays into it. The header and the size of every section are always
+// validated; section checksums are only checked when 'verify' is set, since
+// that touches every page of the file.
+void load_snapshot(const char *filename, bool verify) {
+    INSTRUMENT_SPAN(OP_LOAD_SNAPSHOT);
+    size_t size = 0;
+    char *data = map_file(filename, &size, false);
+    if (!data) {
+        printf("Error opening file!\n");
+        exit(1);
+    }
+
+    SnapshotHeader *header = (SnapshotHeader *)data;
+    if (size < sizeof(SnapshotHeader) || memcmp(header->magic, SNAPSHOT_MAGIC, 8) != 0) {
+        printf("Error in %s: not a snapshot file\n", filename);
+        exit(1);
+    }
+    if (header->byte_order != SNAPSHOT_BYTE_ORDER || header->size_t_size != sizeof(size_t)) {
+        printf("Error in %s: snapshot was written on an incompatible platform\n", filename);
+        exit(1);
+    }
+    if (header->version != SNAPSHOT_VERSION) {
+        printf("Error in %s: unsupported snapshot version %u (expected %d)\n", filename, header->version, SNAPSHOT_VERSION);
+        exit(1);
+    }
+    if (header->header_checksum != checksum64(header, offsetof(SnapshotHeader, header_checksum))) {
+        printf("Error in %s: corrupt snapshot header\n", filename);
+        exit(1);
+    }
+    // The counts in the header must match the section sizes, or later reads
+    // would run past the mapping. Hash indexes need a power-of-two size.
+    uint32_t country_slots = header->country_index_size, id_slots = header->id_index_size, name_slots = header->name_index_size;
+    if (header->user_count < 0 || header->edge_count < 0 || header->country_count < 0 || header->graph_order >= ORDER_COUNT ||
+        (country_slots & (country_slots - 1)) != 0 || (country_slots == 0 && header->country_count > 0) ||
+        id_slots == 0 || (id_slots & (id_slots - 1)) != 0 || name_slots == 0 || (name_slots & (name_slots - 1)) != 0) {
+        printf("Error in %s: corrupt snapshot header\n", filename);
+        exit(1);
+    }
+    uint64_t n = (uint64_t)header->user_count, m = (uint64_t)header->edge_count, c = (uint64_t)header->country_count;
+    uint64_t row_map_size = header->graph_order != ORDER_FILE ? sizeof(int) * n : 0;
+    const uint64_t expected[SECTION_COUNT] = {
+        [SECTION_USER_IDS] = sizeof(int) * n,
+        [SECTION_USER_FOLLOWERS] = sizeof(int) * n,
+        [SECTION_USER_ACTIVITY] = sizeof(float) * n,
+        [SECTION_USER_COUNTRIES] = sizeof(uint16_t) * n,
+        [SECTION_USER_NAMES] = sizeof(size_t) * n,
+        [SECTION_STRINGS] = header->sections[SECTION_STRINGS].size, // any length
+        [SECTION_COUNTRY_NAMES] = sizeof(size_t) * c,
+        [SECTION_COUNTRY_INDEX] = sizeof(NameSlot) * (uint64_t)country_slots,
+        [SECTION_ADJ_OFFSETS] = sizeof(int) * (n + 1),
+        [SECTION_ADJ_TARGETS] = sizeof(int) * m,
+        [SECTION_ID_INDEX] = sizeof(IdSlot) * (uint64_t)id_slots,
+        [SECTION_NAME_INDEX] = sizeof(NameSlot) * (uint64_t)name_slots,
+        [SECTION_NAME_NEXT] = sizeof(int) * n,
+        [SECTION_REV_OFFSETS] = sizeof(int) * (n + 1),
+        [SECTION_REV_TARGETS] = sizeof(int) * m,
+        [SECTION_FOLLOWER_ORDER] = sizeof(int) * n,
+        [SECTION_ACTIVITY_ORDER] = sizeof(int) * n,
+        [SECTION_COUNTRY_POSTINGS] = sizeof(int) * (c + 1),
+        [SECTION_COUNTRY_BY_FOLLOWERS] = sizeof(int) * n,
+        [SECTION_COUNTRY_BY_ACTIVITY] = sizeof(int) * n,
+        [SECTION_USER_ROWS] = row_map_size,
+        [SECTION_ROW_USERS] = row_map_size,
+    };
+    for (int s = 0; s < SECTION_COUNT; s++) {
+        const SnapshotSection *section = &header->sections[s];
+        if (section->size != expected[s]) {
+            printf("Error in %s: corrupt snapshot section %d\n", filename, s);
+            exit(1);
+        }
+        if (section->offset > size || section->size > size - section->offset) {
+            printf("Error in %s: truncated snapshot\n", filename);
+            exit(1);
+        }
+        if (verify && section->checksum != checksum64(data + section->offset, section->size)) {
+            printf("Error in %s: checksum mismatch in section %d\n", filename, s);
+            exit(1);
+        }
+    }
+    const int *forward = (const int *)(data + header->sections[SECTION_ADJ_OFFSETS].offset);
+    const int *backward = (const int *)(data + header->sections[SECTION_REV_OFFSETS].offset);
+    if (forward[0] != 0 || forward[n] != (int)m || backward[0] != 0 || backward[n] != (int)m) {
+        printf("Error in %s: corrupt snapshot adjacency\n", filename);
+        exit(1);
+    }
+
+    snapshot_data = data;
+    snapshot_size = size;
+    user_count = user_capacity = header->user_count;
+    edge_count = edge_capacity = header->edge_count;
+    user_ids = (int *)(data + header->sections[SECTION_USER_IDS].offset);
+    user_followers = (int *)(data + header->sections[SECTION_USER_FOLLOWERS].offset);
+    user_activity = (float *)(data + header->sections[SECTION_USER_ACTIVITY].offset);
+    user_country_ids = (uint16_t *)(data + header->sections[SECTION_USER_COUNTRIES].offset);
+    user_name_offsets = (size_t *)(data + header->sections[SECTION_USER_NAMES].offset);
+    string_pool = data + header->sections[SECTION_STRINGS].offset;
+    string_pool_size = header->sections[SECTION_STRINGS].size;
+    countries.count = countries.capacity = header->country_count;
+    countries.offsets = (size_t *)(data + header->sections[SECTION_COUNTRY_NAMES].offset);
+    countries.slots = header->country_index_size ? (NameSlot *)(data + header->sections[SECTION_COUNTRY_INDEX].offset) : NULL;
+    countries.mask = header->country_index_size - 1;
+    adj_offsets = (int *)(data + header->sections[SECTION_ADJ_OFFSETS].offset);
+    adj_targets = (int *)(data + header->sections[SECTION_ADJ_TARGETS].offset);
+    id_index = (IdSlot *)(data + header->sections[SECTION_ID_INDEX].offset);
+    id_index_mask = header->id_index_size - 1;
+    name_index = (NameSlot *)(data + header->sections[SECTION_NAME_INDEX].offset);
+    name_index_mask = header->name_index_size - 1;
+    name_next = (int *)(data + header->sections[SECTION_NAME_NEXT].offset);
+    rev_offsets = (int *)(data + header->sections[SECTION_REV_OFFSETS].offset);
+    rev_targets = (int *)(data + header->sections[SECTION_REV_TARGETS].offset);
+    follower_order = (int *)(data + header->sections[SECTION_FOLLOWER_ORDER].offset);
+    activity_order = (int *)(data + header->sections[SECTION_ACTIVITY_ORDER].offset);
+    country_postings = (int *)(data + header->sections[SECTION_COUNTRY_POSTINGS].offset);
+    country_by_followers = (int *)(data + header->sections[SECTION_COUNTRY_BY_FOLLOWERS].offset);
+    country_by_activity = (int *)(data + header->sections[SECTION_COUNTRY_BY_ACTIVITY].offset);
+    graph_order = (GraphOrder)header->graph_order;
+    user_rows = graph_order != ORDER_FILE ? (int *)(data + header->sections[SECTION_USER_ROWS].offset) : NULL;
+    row_users = graph_order != ORDER_FILE ? (int *)(data + header->sections[SECTION_ROW_USERS].offset) : NULL;
+}
+
+// Loads a CSV file and builds the adjacency and every index over it, with the
+// users stored in 'order'.
+void load_csv_dataset(const char *filename, GraphOrder order) {
+    load_users(filename);
+    build_indexes();
+    build_graph();
+    reorder_graph(order);
+    build_secondary_indexes();
+}
+
+// Loads a dataset from either a snapshot or a CSV file (detected by content).
+// A snapshot keeps the order it was converted with.
+void load_dataset(const char *filename, bool verify, GraphOrder order) {
+    if (is_snapshot_file(filename)) {
+        load_snapshot(filename, verify);
+        if (order != ORDER_FILE && order != graph_order)
+            fprintf(stderr, "Snapshot users are in %s order; re-run --convert <input.csv> <output.snapshot> %s to change it.\n",
+                    graph_order_names[graph_order], graph_order_names[order]);
+    } else {
+        load_csv_dataset(filename, order);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Direction-optimizing breadth-first search
+//
+// Each level is expanded either top-down (scan the connections of every
+// frontier vertex) or bottom-up (every unvisited vertex scans its reverse
+// connections for a frontier member, stopping at the first hit). Bottom-up
+// steps win when the frontier is large, which on low-diameter social graphs
+// happens after one or two levels. Visited and frontier sets are bitmaps.
+// ---------------------------------------------------------------------------
+
+// Switch to bottom-up when frontier edges exceed unvisited edges / BFS_ALPHA,
+// and back to top-down when the frontier shrinks below n / BFS_BETA vertices.
+#define BFS_ALPHA 14
+#define BFS_BETA 24
+// Graphs with at least this many users are traversed with OpenMP by default.
+#define BFS_PARALLEL_MIN_USERS 100000
+// Vertices a thread collects before appending them to the shared next frontier.
+#define BFS_LOCAL_BATCH 256
+
+// Reusable BFS buffers; one workspace per concurrent traversal.
+typedef struct {
+    uint64_t *visited;
+    uint64_t *frontier;
+    uint64_t *next;
+    int *queue;
+    int *next_queue;
+    int capacity;
+} BfsWorkspace;
+
+static inline bool bit_test(const uint64_t *bits, int i) {
+    return (bits[i >> 6] >> (i & 63)) & 1;
+}
+
+static inline void bit_set(uint64_t *bits, int i) {
+    bits[i >> 6] |= 1ULL << (i & 63);
+}
+
+// Returns the number of 64-bit words in a bitmap of n bits.
+static inline int bitmap_words(int n) {
+    return (n + 63) >> 6;
+}
+
+// Makes sure the workspace can hold 'n' vertices.
+void bfs_workspace_reserve(BfsWorkspace *ws, int n) {
+    if (ws->capacity >= n) return;
+    free(ws->visited);
+    free(ws->frontier);
+    free(ws->next);
+    free(ws->queue);
+    free(ws->next_queue);
+    ws->visited = xmalloc(sizeof(uint64_t) * bitmap_words(n));
+    ws->frontier = xmalloc(sizeof(uint64_t) * bitmap_words(n));
+    ws->next = xmalloc(sizeof(uint64_t) * bitmap_words(n));
+    ws->queue = xmalloc(sizeof(int) * n);
+    ws->next_queue = xmalloc(sizeof(int) * n);
+    ws->capacity = n;
+}
+
+// Releases the workspace buffers.
+void bfs_workspace_free(BfsWorkspace *ws) {
+    free(ws->visited);
+    free(ws->frontier);
+    free(ws->next);
+    free(ws->queue);
+    free(ws->next_queue);
+    memset(ws, 0, sizeof(*ws));
+}
+
+// Expands the frontier in ws->queue by one level, writing the new frontier to
+// ws->next_queue. Returns its size and adds the out-degrees and in-degrees of
+// the newly visited vertices to *next_edges and *claimed_edges.
+static int bfs_top_down_step(BfsWorkspace *ws, int frontier_size, int depth, int *levels, int *parents,
+                             long long *next_edges, long long *claimed_edges, bool parallel) {
+    (void)parallel; // only read by OpenMP
+    int next_size = 0;
+    long long out_edges = 0, in_edges = 0;
+    OMP(parallel if (parallel) reduction(+:out_edges, in_edges))
+    {
+        int batch[BFS_LOCAL_BATCH];
+        int batch_size = 0;
+        OMP(for schedule(dynamic, 64) nowait)
+        for (int q = 0; q < frontier_size; q++) {
+            int v = ws->queue[q];
+            INSTRUMENT_COUNT(COUNTER_EDGES_SCANNED, out_degree(v));
+            NeighbourCursor cursor = out_neighbours(v);
+            for (int w; next_neighbour(&cursor, &w);) {
+                if (bit_test(ws->visited, w)) continue;
+                uint64_t mask = 1ULL << (w & 63), old;
+                OMP(atomic capture)
+                { old = ws->visited[w >> 6]; ws->visited[w >> 6] |= mask; }
+                if (old & mask) continue;
+                if (levels) levels[w] = depth + 1;
+                if (parents) parents[w] = v;
+                out_edges += out_degree(w);
+                in_edges += in_degree(w);
+                batch[batch_size++] = w;
+                if (batch_size == BFS_LOCAL_BATCH) {
+                    int start;
+                    OMP(atomic capture)
+                    { start = next_size; next_size += batch_size; }
+                    memcpy(ws->next_queue + start, batch, sizeof(int) * batch_size);
+                    batch_size = 0;
+                }
+            }
+        }
+        if (batch_size > 0) {
+            int start;
+            OMP(atomic capture)
+            { start = next_size; next_size += batch_size; }
+            memcpy(ws->next_queue + start, batch, sizeof(int) * batch_size);
+        }
+    }
+    *next_edges = out_edges;
+    *claimed_edges = in_edges;
+    return next_size;
+}
+
+// Visits every unvisited vertex with a reverse connection into ws->frontier,
+// building the next frontier bitmap in ws->next. Threads own whole bitmap
+// words, so no atomics are needed. Returns the size of the new frontier.
+static int bfs_bottom_up_step(BfsWorkspace *ws, int n, int depth, int *levels, int *parents,
+                              long long *next_edges, long long *claimed_edges, bool parallel) {
+    (void)parallel; // only read by OpenMP
+    int words = bitmap_words(n);
+    int found = 0;
+    long long out_edges = 0, in_edges = 0;
+    OMP(parallel for if (parallel) schedule(dynamic, 64) reduction(+:found, out_edges, in_edges))
+    for (int wi = 0; wi < words; wi++) {
+        uint64_t unvisited = ~ws->visited[wi];
+        if (wi == words - 1 && (n & 63)) unvisited &= (1ULL << (n & 63)) - 1;
+        uint64_t next_word = 0;
+#ifdef INSTRUMENT
+        uint64_t scanned = 0;
+#endif
+        while (unvisited) {
+            int b = __builtin_ctzll(unvisited);
+            unvisited &= unvisited - 1;
+            int v = (wi << 6) + b;
+            NeighbourCursor cursor = in_neighbours(v);
+            for (int u; next_neighbour(&cursor, &u);) {
+                if (bit_test(ws->frontier, u)) {
+                    next_word |= 1ULL << b;
+                    if (levels) levels[v] = depth + 1;
+                    if (parents) parents[v] = u;
+                    found++;
+                    out_edges += out_degree(v);
+                    in_edges += in_degree(v);
+                    break;
+                }
+            }
+#ifdef INSTRUMENT
+            scanned += cursor.position - rev_begin(v);
+#endif
+        }
+        INSTRUMENT_COUNT(COUNTER_EDGES_SCANNED, scanned);
+        ws->next[wi] = next_word;
+    }
+    OMP(parallel for if (parallel) schedule(static))
+    for (int wi = 0; wi < words; wi++) ws->visited[wi] |= ws->next[wi];
+
+    uint64_t *swap = ws->frontier;
+    ws->frontier = ws->next;
+    ws->next = swap;
+    *next_edges = out_edges;
+    *claimed_edges = in_edges;
+    return found;
+}
+
+// Runs a BFS from user index 'source' over connections, stopping after
+// 'max_depth' levels (negative for no limit). If non-NULL, levels[v] receives
+// the hop count of each user (-1 if not reached) and parents[v] its BFS
+// parent (-1 for the source and unreached users); both need user_count
+// entries. If non-NULL, level_sizes[d] receives the number of users d hops
+// away for every level reached (max_depth + 1 entries; max_depth must then be
+// non-negative). 'parallel' enables OpenMP within each level.
+// Returns the number of users reached, including the source.
+int bfs_levels(BfsWorkspace *ws, int source, int max_depth, int *levels, int *parents, int *level_sizes, bool parallel) {
+    INSTRUMENT_SPAN(OP_BFS);
+    int n = user_count;
+    int words = bitmap_words(n);
+    bfs_workspace_reserve(ws, n);
+    memset(ws->visited, 0, sizeof(uint64_t) * words);
+    if (levels) {
+        for (int v = 0; v < n; v++) levels[v] = -1;
+        levels[source] = 0;
+    }
+    if (parents) {
+        for (int v = 0; v < n; v++) parents[v] = -1;
+    }
+    if (level_sizes) level_sizes[0] = 1;
+    bit_set(ws->visited, source);
+    ws->queue[0] = source;
+
+    int frontier_size = 1, reached = 1, depth = 0;
+    bool bottom_up = false;
+    long long frontier_edges = out_degree(source);
+    long long unvisited_edges = edge_count - in_degree(source);
+
+    while (frontier_size > 0 && (max_depth < 0 || depth < max_depth)) {
+        if (!bottom_up && frontier_edges > unvisited_edges / BFS_ALPHA) {
+            memset(ws->frontier, 0, sizeof(uint64_t) * words);
+            for (int q = 0; q < frontier_size; q++) bit_set(ws->frontier, ws->queue[q]);
+            bottom_up = true;
+        } else if (bottom_up && frontier_size < n / BFS_BETA) {
+            int size = 0;
+            for (int wi = 0; wi < words; wi++) {
+                for (uint64_t bits = ws->frontier[wi]; bits; bits &= bits - 1)
+                    ws->queue[size++] = (wi << 6) + __builtin_ctzll(bits);
+            }
+            bottom_up = false;
+        }
+
+        long long claimed_edges;
+        if (bottom_up) {
+            frontier_size = bfs_bottom_up_step(ws, n, depth, levels, parents, &frontier_edges, &claimed_edges, parallel);
+        } else {
+            frontier_size = bfs_top_down_step(ws, frontier_size, depth, levels, parents, &frontier_edges, &claimed_edges, parallel);
+            int *swap = ws->queue;
+            ws->queue = ws->next_queue;
+            ws->next_queue = swap;
+        }
+        unvisited_edges -= claimed_edges;
+        reached += frontier_size;
+        depth++;
+        if (level_sizes) level_sizes[depth] = frontier_size;
+    }
+    INSTRUMENT_COUNT(COUNTER_VERTICES_VISITED, reached);
+    return reached;
+}
+
+// Reusable buffers for point-to-point shortest path queries. Vertices are
+// marked with a per-query stamp instead of clearing arrays, so back-to-back
+// queries cost only the vertices they touch. One workspace per thread.
+typedef struct {
+    uint32_t *mark;  // stamp: reached forward; stamp + 1: reached backward
+    int *link;       // forward: predecessor; backward: successor towards target
+    int *depth;      // hops from the source (forward) or to the target (backward)
+    int *queue;      // forward frontier grows from the front, backward from the back
+    int *path;       // last path found, source first
+    int capacity;
+    uint32_t stamp;
+} PathWorkspace;
+
+// Makes sure the workspace can hold 'n' vertices.
+void path_workspace_reserve(PathWorkspace *ws, int n) {
+    if (ws->capacity >= n) return;
+    free(ws->mark);
+    free(ws->link);
+    free(ws->depth);
+    free(ws->queue);
+    free(ws->path);
+    ws->mark = xcalloc(n, sizeof(uint32_t));
+    ws->link = xmalloc(sizeof(int) * n);
+    ws->depth = xmalloc(sizeof(int) * n);
+    ws->queue = xmalloc(sizeof(int) * n);
+    ws->path = xmalloc(sizeof(int) * n);
+    ws->capacity = n;
+    ws->stamp = 0;
+}
+
+// Releases the workspace buffers.
+void path_workspace_free(PathWorkspace *ws) {
+    free(ws->mark);
+    free(ws->link);
+    free(ws->depth);
+    free(ws->queue);
+    free(ws->path);
+    memset(ws, 0, sizeof(*ws));
+}
+
+// Finds a shortest directed path from user index 'source' to 'target' with a
+// bidirectional BFS: forward over connections, backward over reverse
+// connections, always expanding the smaller frontier by one whole level.
+// Returns the hop count and stores the path (source .. target) in ws->path,
+// or returns -1 if 'target' is unreachable.
+int shortest_path(PathWorkspace *ws, int source, int target) {
+    INSTRUMENT_SPAN(OP_SHORTEST_PATH);
+    path_workspace_reserve(ws, user_count);
+    if (ws->stamp >= UINT32_MAX - 2) {
+        memset(ws->mark, 0, sizeof(uint32_t) * ws->capacity);
+        ws->stamp = 0;
+    }
+    ws->stamp += 2;
+    uint32_t forward = ws->stamp, backward = ws->stamp + 1;
+
+    ws->path[0] = source;
+    if (source == target) return 0;
+
+    // Forward frontier occupies queue[f_begin, f_end); backward occupies
+    // queue[b_begin, b_end) filling down from the end. Each vertex is queued
+    // at most once in total, so the halves never collide.
+    int *queue = ws->queue;
+    int f_begin = 0, f_end = 0, b_begin = user_count, b_end = user_count;
+    ws->mark[source] = forward;
+    ws->link[source] = -1;
+    ws->depth[source] = 0;
+    queue[f_end++] = source;
+    ws->mark[target] = backward;
+    ws->link[target] = -1;
+    ws->depth[target] = 0;
+    queue[--b_begin] = target;
+
+    int best = -1, meet_from = -1, meet_to = -1;
+    while (best < 0 && f_begin < f_end && b_begin < b_end) {
+        long long forward_work = 0, backward_work = 0;
+        for (int q = f_begin; q < f_end; q++) forward_work += out_degree(queue[q]);
+        for (int q = b_begin; q < b_end; q++) backward_work += in_degree(queue[q]);
+        INSTRUMENT_COUNT(COUNTER_EDGES_SCANNED, forward_work <= backward_work ? forward_work : backward_work);
+
+        if (forward_work <= backward_work) {
+            int level_end = f_end;
+            for (int q = f_begin; q < level_end; q++) {
+                int v = queue[q];
+                NeighbourCursor cursor = out_neighbours(v);
+                for (int w; next_neighbour(&cursor, &w);) {
+                    if (ws->mark[w] == backward) {
+                        int total = ws->depth[v] + 1 + ws->depth[w];
+                        if (best < 0 || total < best) {
+                            best = total;
+                            meet_from = v;
+                            meet_to = w;
+                        }
+                    } else if (ws->mark[w] != forward) {
+                        ws->mark[w] = forward;
+                        ws->link[w] = v;
+                        ws->depth[w] = ws->depth[v] + 1;
+                        queue[f_end++] = w;
+                    }
+                }
+            }
+            f_begin = level_end;
+        } else {
+            int level_begin = b_begin;
+            for (int q = b_end - 1; q >= level_begin; q--) {
+                int v = queue[q];
+                NeighbourCursor cursor = in_neighbours(v);
+                for (int w; next_neighbour(&cursor, &w);) {
+                    if (ws->mark[w] == forward) {
+                        int total = ws->depth[w] + 1 + ws->depth[v];
+                        if (best < 0 || total < best) {
+                            best = total;
+                            meet_from = w;
+                            meet_to = v;
+                        }
+                    } else if (ws->mark[w] != backward) {
+                        ws->mark[w] = backward;
+                        ws->link[w] = v;
+                        ws->depth[w] = ws->depth[v] + 1;
+                        queue[--b_begin] = w;
+                    }
+                }
+            }
+            b_end = level_begin;
+        }
+    }
+    INSTRUMENT_COUNT(COUNTER_VERTICES_VISITED, f_end + (user_count - b_begin));
+    if (best < 0) return -1;
+
+    // Walk back to the source, reverse, then walk forward to the target.
+    int length = 0;
+    for (int v = meet_from; v != -1; v = ws->link[v]) ws->path[length++] = v;
+    for (int i = 0, j = length - 1; i < j; i++, j--) {
+        int tmp = ws->path[i];
+        ws->path[i] = ws->path[j];
+        ws->path[j] = tmp;
+    }
+    for (int v = meet_to; v != -1; v = ws->link[v]) ws->path[length++] = v;
+    return best;
+}
+
+// Resolves a user given either a numeric User ID or a name. Returns -1 if not found.
+int resolve_user(const char *text) {
+    INSTRUMENT_SPAN(OP_RESOLVE_USER);
+    char *end;
+    errno = 0;
+    long id = strtol(text, &end, 10);
+    // IDs that do not fit an int are tried as names rather than truncated.
+    if (*text != '\0' && *end == '\0' && errno != ERANGE && id >= INT_MIN && id <= INT_MAX) {
+        int index = find_user_by_id((int)id);
+        if (index != -1) return index;
+    }
+    return find_user_by_name(text);
+}
+
+// Writes the depth-first preorder of the users reachable from 'source' into
+// 'order' (user_count entries) and returns how many were visited. Uses an
+// explicit stack of (vertex, next connection) pairs instead of recursion, so
+// long chains cannot overflow the call stack; neighbours are visited in the
+// same ascending order as the recursive version. The visited bitmap and the
+// stacks are borrowed from a BFS workspace.
+int dfs_preorder(BfsWorkspace *ws, int source, int *order) {
+    INSTRUMENT_SPAN(OP_DFS);
+    bfs_workspace_reserve(ws, user_count);
+    uint64_t *visited = ws->visited;
+    int *stack_vertex = ws->queue;
+    int *stack_edge = ws->next_queue;
+    int count = 0, top = 0;
+    memset(visited, 0, sizeof(uint64_t) * bitmap_words(user_count));
+
+    // Only the top frame has a live cursor; the others keep their position
+    // and are re-entered from it when the frame above returns.
+    bit_set(visited, source);
+    order[count++] = source;
+    stack_vertex[top++] = source;
+    NeighbourCursor cursor = out_neighbours(source);
+    while (top > 0) {
+        int w;
+        if (!next_neighbour(&cursor, &w)) {
+            if (--top > 0) cursor = out_neighbours_from(stack_vertex[top - 1], stack_edge[top - 1]);
+            continue;
+        }
+        INSTRUMENT_COUNT(COUNTER_EDGES_SCANNED, 1);
+        if (!bit_test(visited, w)) {
+            bit_set(visited, w);
+            order[count++] = w;
+            stack_edge[top - 1] = cursor.position;
+            stack_vertex[top++] = w;
+            cursor = out_neighbours(w);
+        }
+    }
+    INSTRUMENT_COUNT(COUNTER_VERTICES_VISITED, count);
+    return count;
+}
+
+// ---------------------------------------------------------------------------
+// Connected components
+//
+// Connections are directed, so two notions are tracked: strongly connected
+// components (mutually reachable users, Tarjan's algorithm) and weakly
+// connected components (connected when direction is ignored, union-find).
+// Both are computed in one linear pass on first use and cached per user.
+// Graph mutations keep weak components current by merging labels and only
+// invalidate strong components when an edge can change them.
+// ---------------------------------------------------------------------------
+
+int *scc_id = NULL;   // strongly connected component of each user
+int *scc_size = NULL; // users per strongly connected component
+int scc_count = 0;
+int *wcc_id = NULL;     // weak component label of each user
+int *wcc_parent = NULL; // union-find over labels; merged labels point at their survivor
+int *wcc_size = NULL;   // users per weakly connected component, valid at root labels
+int wcc_labels = 0;     // labels handed out
+int wcc_count = 0;      // root labels, i.e. weakly connected components
+bool scc_valid = false;
+bool wcc_valid = false;
+
+// Assigns strongly connected components with an iterative Tarjan's algorithm.
+// Components are numbered in the order they complete, which is a reverse
+// topological order: an edge between different components always goes from a
+// higher to a lower scc_id.
+static void compute_strong_components() {
+    INSTRUMENT_SPAN(OP_STRONG_COMPONENTS);
+    int n = user_count;
+    int *index_of = xmalloc(sizeof(int) * n);
+    int *low = xmalloc(sizeof(int) * n);
+    int *stack = xmalloc(sizeof(int) * n);
+    int *call_vertex = xmalloc(sizeof(int) * n);
+    int *call_edge = xmalloc(sizeof(int) * n);
+    for (int v = 0; v < n; v++) {
+        index_of[v] = -1;
+        scc_id[v] = -1;
+    }
+
+    int counter = 0, sp = 0;
+    scc_count = 0;
+    for (int root = 0; root < n; root++) {
+        if (index_of[root] >= 0) continue;
+        int top = 0;
+        index_of[root] = low[root] = counter++;
+        stack[sp++] = root;
+        call_vertex[top++] = root;
+        NeighbourCursor cursor = out_neighbours(root); // of the top frame, as in dfs_preorder()
+
+        while (top > 0) {
+            int v = call_vertex[top - 1], w;
+            if (next_neighbour(&cursor, &w)) {
+                if (index_of[w] < 0) {
+                    index_of[w] = low[w] = counter++;
+                    stack[sp++] = w;
+                    call_edge[top - 1] = cursor.position;
+                    call_vertex[top++] = w;
+                    cursor = out_neighbours(w);
+                } else if (scc_id[w] < 0 && index_of[w] < low[v]) {
+                    low[v] = index_of[w]; // w is still on the Tarjan stack
+                }
+                continue;
+            }
+
+            top--;
+            if (low[v] == index_of[v]) {
+                int w;
+                do {
+                    w = stack[--sp];
+                    scc_id[w] = scc_count;
+                } while (w != v);
+                scc_count++;
+            }
+            if (top > 0) {
+                int parent = call_vertex[top - 1];
+                if (low[v] < low[parent]) low[parent] = low[v];
+                cursor = out_neighbours_from(parent, call_edge[top - 1]);
+            }
+        }
+    }
+
+    free(call_edge);
+    free(call_vertex);
+    free(stack);
+    free(low);
+    free(index_of);
+}
+
+// Finds the union-find root of v, halving the path as it goes.
+static inline int find_root(int *parent, int v) {
+    while (parent[v] != v) {
+        parent[v] = parent[parent[v]];
+        v = parent[v];
+    }
+    return v;
+}
+
+// Assigns weakly connected components with union-find (union by size) over
+// every connection, then numbers the roots densely in user order.
+static void compute_weak_components() {
+    INSTRUMENT_SPAN(OP_WEAK_COMPONENTS);
+    int n = user_count;
+    int *parent = xmalloc(sizeof(int) * n);
+    int *size = xmalloc(sizeof(int) * n);
+    for (int v = 0; v < n; v++) {
+        parent[v] = v;
+        size[v] = 1;
+    }
+    for (int v = 0; v < n; v++) {
+        NeighbourCursor cursor = out_neighbours(v);
+        for (int w; next_neighbour(&cursor, &w);) {
+            int a = find_root(parent, v), b = find_root(parent, w);
+            if (a == b) continue;
+            if (size[a] < size[b]) {
+                int tmp = a;
+                a = b;
+                b = tmp;
+            }
+            parent[b] = a;
+            size[a] += size[b];
+        }
+    }
+
+    wcc_count = 0;
+    for (int v = 0; v < n; v++) wcc_id[v] = -1;
+    for (int v = 0; v < n; v++) {
+        int root = find_root(parent, v);
+        if (wcc_id[root] < 0) wcc_id[root] = wcc_count++;
+        wcc_id[v] = wcc_id[root];
+    }
+    wcc_labels = wcc_count;
+    free(wcc_parent);
+    free(wcc_size);
+    wcc_parent = xmalloc(sizeof(int) * (wcc_labels ? wcc_labels : 1));
+    wcc_size = xcalloc(wcc_labels, sizeof(int));
+    for (int c = 0; c < wcc_labels; c++) wcc_parent[c] = c;
+    for (int v = 0; v < n; v++) wcc_size[wcc_id[v]]++;
+
+    free(size);
+    free(parent);
+}
+
+// Returns the weakly connected component (root label) of user v. Does not
+// modify the forest, so concurrent readers are safe.
+static inline int weak_component(int v) {
+    int label = wcc_id[v];
+    while (wcc_parent[label] != label) label = wcc_parent[label];
+    return label;
+}
+
+// Computes the strongly and weakly connected component of every user, unless
+// they are still valid.
+void compute_components() {
+    int n = user_count;
+    if (!scc_valid) {
+        free(scc_id);
+        free(scc_size);
+        scc_id = xmalloc(sizeof(int) * (user_capacity ? user_capacity : 1));
+        compute_strong_components();
+        scc_size = xcalloc(scc_count, sizeof(int));
+        for (int v = 0; v < n; v++) scc_size[scc_id[v]]++;
+        scc_valid = true;
+    }
+    if (!wcc_valid) {
+        free(wcc_id);
+        wcc_id = xmalloc(sizeof(int) * (user_capacity ? user_capacity : 1));
+        compute_weak_components();
+        wcc_valid = true;
+    }
+}
+
+// Returns true if user index 'to' can be reached from 'from' by following
+// connections. Most answers come from the cached component ids in O(1):
+// different weak components can never reach each other, the same strong
+// component always can, and edges only lead to lower scc ids. The remaining
+// cases fall back to a bidirectional BFS in 'ws'. Safe to call from several
+// threads with separate workspaces once compute_components() has run.
+bool can_reach_with(PathWorkspace *ws, int from, int to) {
+    INSTRUMENT_SPAN(OP_REACHABILITY);
+    compute_components();
+    if (from == to || scc_id[from] == scc_id[to]) return true;
+    if (weak_component(from) != weak_component(to) || scc_id[to] > scc_id[from]) return false;
+    return shortest_path(ws, from, to) >= 0;
+}
+
+// ---------------------------------------------------------------------------
+// All-pairs shortest paths
+//
+// Hop distances are kept in a heap-allocated n x n matrix of 16-bit values
+// (row stride apsp_stride, padded to a whole number of tiles) so they can be
+// queried after the computation. Dense graphs use a cache-blocked
+// Floyd-Warshall whose min-plus tile kernel vectorizes; sparse graphs run one
+// BFS per source. Both are parallelized with OpenMP.
+// ---------------------------------------------------------------------------
+
+typedef uint16_t dist_t;
+
+// DIST_INF + DIST_INF still fits in dist_t, so the min-plus kernel needs no
+// overflow checks: any sum involving DIST_INF loses to an existing distance.
+#define DIST_INF 0x7FFF
+#define APSP_TILE 64
+#define APSP_MAX_BYTES (1ULL << 32)
+
+dist_t *apsp_dist = NULL;
+int apsp_n = 0;
+int apsp_stride = 0;
+bool apsp_valid = false;
+
+// Relaxes tile C through tile A (rows of C, column block k) and tile B (row
+// block k, columns of C): C[i][j] = min(C[i][j], A[i][k] + B[k][j]).
+// C may alias A or B; the k loop is outermost, as Floyd-Warshall requires.
+static void apsp_tile_kernel(dist_t *c, const dist_t *a, const dist_t *b, int stride) {
+    for (int k = 0; k < APSP_TILE; k++) {
+        const dist_t *b_row = b + (size_t)k * stride;
+        for (int i = 0; i < APSP_TILE; i++) {
+            dist_t *c_row = c + (size_t)i * stride;
+            dist_t a_ik = a[(size_t)i * stride + k];
+            if (a_ik == DIST_INF) continue;
+            OMP(simd)
+            for (int j = 0; j < APSP_TILE; j++) {
+                dist_t through_k = (dist_t)(a_ik + b_row[j]);
+                c_row[j] = through_k < c_row[j] ? through_k : c_row[j];
+            }
+        }
+    }
+}
+
+// Blocked Floyd-Warshall over the padded matrix. For each diagonal tile, the
+// tile itself is closed first, then its tile row and column, then every
+// remaining tile; tiles within the last two phases are independent.
+static void apsp_floyd_warshall_blocked(dist_t *dist, int stride) {
+    int tiles = stride / APSP_TILE;
+    for (int kb = 0; kb < tiles; kb++) {
+        dist_t *diagonal = dist + ((size_t)kb * stride + kb) * APSP_TILE;
+        apsp_tile_kernel(diagonal, diagonal, diagonal, stride);
+
+        OMP(parallel for schedule(dynamic, 1))
+        for (int t = 0; t < tiles; t++) {
+            if (t == kb) continue;
+            dist_t *row_tile = dist + ((size_t)kb * stride + t) * APSP_TILE;
+            dist_t *column_tile = dist + ((size_t)t * stride + kb) * APSP_TILE;
+            apsp_tile_kernel(row_tile, diagonal, row_tile, stride);
+            apsp_tile_kernel(column_tile, column_tile, diagonal, stride);
+        }
+
+        OMP(parallel for collapse(2) schedule(dynamic, 1))
+        for (int ib = 0; ib < tiles; ib++) {
+            for (int jb = 0; jb < tiles; jb++) {
+                if (ib == kb || jb == kb) continue;
+                apsp_tile_kernel(dist + ((size_t)ib * stride + jb) * APSP_TILE,
+                                 dist + ((size_t)ib * stride + kb) * APSP_TILE,
+                                 dist + ((size_t)kb * stride + jb) * APSP_TILE, stride);
+            }
+        }
+    }
+}
+
+// Fills each matrix row with BFS hop counts from that source, one source per task.
+static void apsp_bfs_all_sources(dist_t *dist, int n, int stride) {
+    OMP(parallel)
+    {
+        int *queue = xmalloc(sizeof(int) * n);
+        OMP(for schedule(dynamic, 16))
+        for (int source = 0; source < n; source++) {
+            dist_t *row = dist + (size_t)source * stride;
+            int front = 0, rear = 0;
+            row[source] = 0;
+            queue[rear++] = source;
+            while (front < rear) {
+                int v = queue[front++];
+                dist_t next = row[v] < DIST_INF - 1 ? (dist_t)(row[v] + 1) : (dist_t)(DIST_INF - 1);
+                NeighbourCursor cursor = out_neighbours(v);
+                for (int w; next_neighbour(&cursor, &w);) {
+                    if (row[w] == DIST_INF) {
+                        row[w] = next;
+                        queue[rear++] = w;
+                    }
+                }
+            }
+        }
+        free(queue);
+    }
+}
+
+// Returns the size in bytes of the all-pairs matrix for the current graph.
+unsigned long long all_pairs_bytes() {
+    unsigned long long stride = (user_count + APSP_TILE - 1) / APSP_TILE * APSP_TILE;
+    if (stride == 0) stride = APSP_TILE;
+    return stride * stride * sizeof(dist_t);
+}
+
+// Computes hop distances between every pair of users into apsp_dist.
+// Returns false (leaving no matrix) if all_pairs_bytes() exceeds APSP_MAX_BYTES.
+bool compute_all_pairs() {
+    if (apsp_valid) return true;
+    INSTRUMENT_SPAN(OP_ALL_PAIRS);
+    int n = user_count;
+    int stride = (n + APSP_TILE - 1) / APSP_TILE * APSP_TILE;
+    if (stride == 0) stride = APSP_TILE;
+    unsigned long long bytes = all_pairs_bytes();
+    if (bytes > APSP_MAX_BYTES) return false;
+
+    free(apsp_dist);
+    apsp_dist = xmalloc((size_t)bytes);
+    OMP(parallel for schedule(static))
+    for (int i = 0; i < stride; i++) {
+        dist_t *row = apsp_dist + (size_t)i * stride;
+        for (int j = 0; j < stride; j++) row[j] = DIST_INF;
+        row[i] = 0;
+    }
+
+    // Floyd-Warshall costs O(n^3) regardless of density; n BFS runs cost O(n * (n + m)).
+    bool dense = (double)edge_count > (double)n * n / 16.0;
+    if (dense) {
+        for (int i = 0; i < n; i++) {
+            NeighbourCursor cursor = out_neighbours(i);
+            for (int j; next_neighbour(&cursor, &j);) {
+                if (j != i) apsp_dist[(size_t)i * stride + j] = 1;
+            }
+        }
+        apsp_floyd_warshall_blocked(apsp_dist, stride);
+    } else {
+        apsp_bfs_all_sources(apsp_dist, n, stride);
+    }
+
+    apsp_n = n;
+    apsp_stride = stride;
+    apsp_valid = true;
+    return true;
+}
+
+// Returns the hop distance from user index 'from' to 'to', or -1 if 'to' is
+// unreachable. compute_all_pairs() must have succeeded.
+int apsp_distance(int from, int to) {
+    dist_t d = apsp_dist[(size_t)from * apsp_stride + to];
+    return d == DIST_INF ? -1 : d;
+}
+
+// ---------------------------------------------------------------------------
+// Mutual connections
+//
+// Neighbour lists are sorted, so mutual connections are a sorted-set
+// intersection. The kernel is picked per pair: a bitmap probe when one side
+// is a hub, galloping when the lists differ greatly in length, a 4x4 SSE2
+// block compare for longer lists and a branch-free merge otherwise. Every
+// kernel writes the common users in ascending order to 'out', or only counts
+// them when 'out' is NULL.
+// ---------------------------------------------------------------------------
+
+// Lists this many times longer than the other side are galloped through.
+#define INTERSECT_GALLOP_RATIO 32
+// Shorter lists than this are merged without SIMD.
+#define INTERSECT_SIMD_MIN_LENGTH 16
+// Users with at least max(HUB_MIN_DEGREE, n / 32) connections get a bitmap.
+#define HUB_MIN_DEGREE 1024
+
+uint64_t **hub_bits = NULL; // per user: bitmap of connections, NULL if not a hub
+int hub_bits_users = 0;     // users covered by hub_bits (and bits per bitmap)
+int hub_threshold = 0;
+int max_out_degree = 0;     // highest out_degree() while hub_bits are valid (an upper bound after removals)
+bool hub_bits_valid = false;
+
+static int intersect_merge(const int *a, int na, const int *b, int nb, int *out) {
+    int i = 0, j = 0, count = 0;
+    while (i < na && j < nb) {
+        int x = a[i], y = b[j];
+        if (out && x == y) out[count] = x;
+        count += (x == y);
+        i += (x <= y);
+        j += (y <= x);
+    }
+    return count;
+}
+
+// Walks the short list and finds each element in the long one by exponential
+// then binary search, resuming from the previous position.
+static int intersect_gallop(const int *small, int ns, const int *large, int nl, int *out) {
+    int count = 0, lo = 0;
+    for (int i = 0; i < ns && lo < nl; i++) {
+        int x = small[i];
+        if (large[lo] < x) {
+            int step = 1;
+            while (lo + step < nl && large[lo + step] < x) step <<= 1;
+            int hi = lo + step < nl ? lo + step : nl - 1;
+            lo += step >> 1;
+            while (lo < hi) { // first position in (lo, hi] with large[pos] >= x
+                int mid = lo + ((hi - lo) >> 1);
+                if (large[mid] < x) lo = mid + 1;
+                else hi = mid;
+            }
+        }
+        if (large[lo] == x) {
+            if (out) out[count] = x;
+            count++;
+        }
+    }
+    return count;
+}
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+// Compares blocks of four from each list against each other (all four
+// rotations), emitting matches from 'a', then finishes with a scalar merge.
+static int intersect_simd(const int *a, int na, const int *b, int nb, int *out) {
+    int i = 0, j = 0, count = 0;
+    while (i + 4 <= na && j + 4 <= nb) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + j));
+        __m128i eq0 = _mm_cmpeq_epi32(va, vb);
+        __m128i eq1 = _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1)));
+        __m128i eq2 = _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2)));
+        __m128i eq3 = _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3)));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(_mm_or_si128(eq0, eq1), _mm_or_si128(eq2, eq3))));
+        if (out) {
+            for (; mask; mask &= mask - 1) out[count++] = a[i + __builtin_ctz(mask)];
+        } else {
+            count += __builtin_popcount(mask);
+        }
+        int a_max = a[i + 3], b_max = b[j + 3];
+        i += (a_max <= b_max) ? 4 : 0;
+        j += (b_max <= a_max) ? 4 : 0;
+    }
+    return count + intersect_merge(a + i, na - i, b + j, nb - j, out ? out + count : NULL);
+}
+#else
+#define intersect_simd intersect_merge
+#endif
+
+// Intersects two ascending lists with the kernel suited to their lengths,
+// writing the common values to 'out' or only counting them if it is NULL.
+int intersect_sorted(const int *a, int na, const int *b, int nb, int *out) {
+    if (na > nb) {
+        const int *tmp = a;
+        a = b;
+        b = tmp;
+        int tmp_length = na;
+        na = nb;
+        nb = tmp_length;
+    }
+    if (na == 0) return 0;
+    if (nb >= na * INTERSECT_GALLOP_RATIO) return intersect_gallop(a, na, b, nb, out);
+    if (na >= INTERSECT_SIMD_MIN_LENGTH) return intersect_simd(a, na, b, nb, out);
+    return intersect_merge(a, na, b, nb, out);
+}
+
+// Builds connection bitmaps for hub users, whose lists are long enough that
+// probing a bitmap beats walking the list, and records max_out_degree on the
+// same pass. Must run before parallel queries.
+void prepare_intersections() {
+    if (hub_bits_valid) return;
+    INSTRUMENT_SPAN(OP_HUB_BITMAPS);
+    if (hub_bits) {
+        for (int v = 0; v < hub_bits_users; v++) free(hub_bits[v]);
+        free(hub_bits);
+    }
+    hub_bits_users = user_count;
+    hub_threshold = user_count / 32 > HUB_MIN_DEGREE ? user_count / 32 : HUB_MIN_DEGREE;
+    hub_bits = xcalloc(user_count, sizeof(uint64_t *));
+    max_out_degree = 0;
+    for (int v = 0; v < user_count; v++) {
+        int degree = out_degree(v);
+        if (degree > max_out_degree) max_out_degree = degree;
+        if (degree < hub_threshold) continue;
+        hub_bits[v] = xcalloc(bitmap_words(user_count), sizeof(uint64_t));
+        NeighbourCursor cursor = out_neighbours(v);
+        for (int w; next_neighbour(&cursor, &w);) bit_set(hub_bits[v], w);
+    }
+    hub_bits_valid = true;
+}
+
+// Writes the users that both user indices u and v list as connections to
+// 'out' in ascending order (or just counts them if 'out' is NULL). 'out' needs
+// room for min(out_degree(u), out_degree(v)) entries. prepare_intersections()
+// must have run. Returns the number of mutual connections.
+int intersect_connections(int u, int v, int *out) {
+    if (out_degree(u) > out_degree(v)) {
+        int tmp = u;
+        u = v;
+        v = tmp;
+    }
+    int na = out_degree(u), nb = out_degree(v);
+    if (na == 0) return 0;
+
+    // Compressed lists are merged as they decode.
+    if (graph_compressed) {
+        NeighbourCursor a = out_neighbours(u), b = out_neighbours(v);
+        int count = 0;
+        if (hub_bits[v]) {
+            for (int w; next_neighbour(&a, &w);) {
+                if (bit_test(hub_bits[v], w)) {
+                    if (out) out[count] = w;
+                    count++;
+                }
+            }
+            return count;
+        }
+        int x = next_neighbour_or_max(&a), y = next_neighbour_or_max(&b);
+        while (x != INT_MAX && y != INT_MAX) {
+            if (x < y) {
+                x = next_neighbour_or_max(&a);
+            } else if (y < x) {
+                y = next_neighbour_or_max(&b);
+            } else {
+                if (out) out[count] = x;
+                count++;
+                x = next_neighbour_or_max(&a);
+                y = next_neighbour_or_max(&b);
+            }
+        }
+        return count;
+    }
+
+    const int *a = adj_targets + adj_begin(u), *b = adj_targets + adj_begin(v);
+    if (hub_bits[v]) {
+        int count = 0;
+        for (int i = 0; i < na; i++) {
+            if (bit_test(hub_bits[v], a[i])) {
+                if (out) out[count] = a[i];
+                count++;
+            }
+        }
+        return count;
+    }
+    return intersect_sorted(a, na, b, nb, out);
+}
+
+// Similarity scores for one pair of users (indices u, v).
+typedef struct {
+    int u, v;
+    int mutual_count;   // users both u and v are connected to
+    double jaccard;     // mutual_count / size of the union of both lists
+    double adamic_adar; // sum over mutuals w of 1 / ln(total degree of w)
+} PairSimilarity;
+
+// Computes the Adamic-Adar score of a list of mutual connections.
+static double adamic_adar_score(const int *mutuals, int count) {
+    double score = 0.0;
+    for (int i = 0; i < count; i++) {
+        int degree = out_degree(mutuals[i]) + in_degree(mutuals[i]);
+        if (degree > 1) score += 1.0 / log((double)degree);
+    }
+    return score;
+}
+
+// Fills the mutual count, Jaccard and Adamic-Adar scores of one pair, using
+// 'scratch' (room for min(out_degree(u), out_degree(v)) entries) for the mutuals.
+void pair_similarity(PairSimilarity *pair, int *scratch) {
+    INSTRUMENT_SPAN(OP_MUTUALS);
+    int du = out_degree(pair->u), dv = out_degree(pair->v);
+    INSTRUMENT_COUNT(COUNTER_INTERSECTIONS, 1);
+    int count = intersect_connections(pair->u, pair->v, scratch);
+    int union_size = du + dv - count;
+    pair->mutual_count = count;
+    pair->jaccard = union_size > 0 ? (double)count / union_size : 0.0;
+    pair->adamic_adar = adamic_adar_score(scratch, count);
+}
+
+// Scores many pairs in one call, in parallel. Each entry's u and v must be
+// set; the remaining fields are filled in. Per-thread scratch is sized by
+// max_out_degree, so a call costs nothing per user beyond its pairs.
+void mutual_scores_batch(PairSimilarity *pairs, int count) {
+    prepare_intersections();
+    OMP(parallel)
+    {
+        int *scratch = xmalloc(sizeof(int) * (max_out_degree ? max_out_degree : 1));
+        OMP(for schedule(dynamic, 64))
+        for (int p = 0; p < count; p++) pair_similarity(&pairs[p], scratch);
+        free(scratch);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Triangles and clustering
+//
+// Connections are treated as undirected here. Each user's neighbours
+// (connections and followers, merged) are oriented towards users of higher
+// degree, ties by index, which keeps every oriented list short even for hubs.
+// Every triangle is then found exactly once, at its lowest-ranked corner u, by
+// intersecting u's oriented list with that of each of its oriented neighbours
+// using the mutual connection kernels. Users are processed in parallel and the
+// counts of the two other corners are added atomically. The local clustering
+// coefficient of a user is the fraction of pairs of its neighbours that are
+// themselves connected.
+// ---------------------------------------------------------------------------
+
+long long *triangle_count = NULL; // triangles through each user
+float *clustering = NULL;         // local clustering coefficient of each user
+long long total_triangles = 0;
+double average_clustering = 0.0;  // mean local clustering coefficient over live users
+double transitivity = 0.0;        // 3 * triangles / connected neighbour pairs, whole graph
+bool triangles_valid = false;
+
+// Writes the connections and followers of u merged, ascending, without u, to
+// 'out'; with 'rank_degree' set, only those that rank above u by that degree.
+// Only counts them if 'out' is NULL. Returns how many there are.
+static int undirected_neighbours(int u, const int *rank_degree, int *out) {
+    NeighbourCursor forward = out_neighbours(u), backward = in_neighbours(u);
+    int x = next_neighbour_or_max(&forward), y = next_neighbour_or_max(&backward), count = 0;
+    while (x != INT_MAX || y != INT_MAX) {
+        int w = x < y ? x : y;
+        if (x == w) x = next_neighbour_or_max(&forward);
+        if (y == w) y = next_neighbour_or_max(&backward);
+        if (w == u) continue;
+        if (rank_degree && (rank_degree[w] < rank_degree[u] || (rank_degree[w] == rank_degree[u] && w < u))) continue;
+        if (out) out[count] = w;
+        count++;
+    }
+    return count;
+}
+
+// Counts the triangles through every user and their clustering coefficients,
+// unless they are current.
+void compute_triangles() {
+    if (triangles_valid) return;
+    INSTRUMENT_SPAN(OP_TRIANGLES);
+    int n = user_count;
+    int *degree = xmalloc(sizeof(int) * (n ? n : 1));
+    int *offsets = xmalloc(sizeof(int) * (n + 1));
+    OMP(parallel for schedule(dynamic, 1024))
+    for (int u = 0; u < n; u++) degree[u] = undirected_neighbours(u, NULL, NULL);
+    OMP(parallel for schedule(dynamic, 1024))
+    for (int u = 0; u < n; u++) offsets[u + 1] = undirected_neighbours(u, degree, NULL);
+    offsets[0] = 0;
+    int longest = 0;
+    for (int u = 0; u < n; u++) {
+        if (offsets[u + 1] > longest) longest = offsets[u + 1];
+        offsets[u + 1] += offsets[u];
+    }
+    int *targets = xmalloc(sizeof(int) * (offsets[n] ? offsets[n] : 1));
+    OMP(parallel for schedule(dynamic, 1024))
+    for (int u = 0; u < n; u++) undirected_neighbours(u, degree, targets + offsets[u]);
+
+    free(triangle_count);
+    triangle_count = xcalloc(n, sizeof(long long));
+    long long total = 0;
+    OMP(parallel reduction(+:total))
+    {
+        int *common = xmalloc(sizeof(int) * (longest ? longest : 1));
+        OMP(for schedule(dynamic, 64))
+        for (int u = 0; u < n; u++) {
+            const int *a = targets + offsets[u];
+            int na = offsets[u + 1] - offsets[u];
+            long long found = 0;
+            for (int k = 0; k < na; k++) {
+                int v = a[k];
+                int shared = intersect_sorted(a, na, targets + offsets[v], offsets[v + 1] - offsets[v], common);
+                if (shared == 0) continue;
+                found += shared;
+                OMP(atomic)
+                triangle_count[v] += shared;
+                for (int i = 0; i < shared; i++) {
+                    OMP(atomic)
+                    triangle_count[common[i]]++;
+                }
+            }
+            INSTRUMENT_COUNT(COUNTER_INTERSECTIONS, na);
+            if (found) {
+                OMP(atomic)
+                triangle_count[u] += found;
+            }
+            total += found;
+        }
+        free(common);
+    }
+
+    free(clustering);
+    clustering = xmalloc(sizeof(float) * (n ? n : 1));
+    double wedges = 0.0, clustering_sum = 0.0;
+    for (int u = 0; u < n; u++) {
+        double pairs = (double)degree[u] * (degree[u] - 1) / 2;
+        clustering[u] = pairs > 0 ? (float)(triangle_count[u] / pairs) : 0.0f;
+        wedges += pairs;
+        if (!is_user_removed(u)) clustering_sum += clustering[u];
+    }
+    total_triangles = total;
+    transitivity = wedges > 0 ? 3.0 * total / wedges : 0.0;
+    average_clustering = live_user_count() > 0 ? clustering_sum / live_user_count() : 0.0;
+    free(targets);
+    free(offsets);
+    free(degree);
+    triangles_valid = true;
+}
+
+// ---------------------------------------------------------------------------
+// Sketches
+//
+// Approximate answers that would otherwise need a traversal per user, kept
+// next to the graph and read in O(1):
+//
+// - Reach: a HyperLogLog counter per user estimates how many users are within
+//   1..SKETCH_HOPS hops of it. Counter k of u is the union of counter k - 1 of
+//   u and of each of its connections, so every hop is one parallel pass over
+//   the edges (the HyperANF neighbourhood function). The relative error is
+//   about 1.04 / sqrt(HLL_REGISTERS); small audiences are counted almost
+//   exactly.
+// - Similarity: a MinHash signature of each user's connections estimates the
+//   Jaccard similarity of two connection sets as the fraction of equal
+//   entries. Signatures are split into LSH_BANDS bands and users are bucketed
+//   by each band, so users with near-duplicate connections (similarity above
+//   about 0.7) share a bucket with high probability, and finding them only
+//   looks at the user's own buckets.
+//
+// Users are hashed by ID, so the estimates do not depend on --reorder. They
+// are recomputed on next use after the graph changes.
+// ---------------------------------------------------------------------------
+
+#define SKETCH_HOPS 4          // reach is estimated within 1..SKETCH_HOPS hops
+#define HLL_REGISTERS 64       // per user while computing; a power of two
+#define MINHASH_SIZE 16        // hashes per signature
+#define LSH_BANDS 4            // bands of MINHASH_SIZE / LSH_BANDS hashes
+#define SIMILAR_CANDIDATES 256 // users looked at per band by similar_users()
+
+float *reach_estimate = NULL; // [u * SKETCH_HOPS + k - 1]: users within k hops of u
+uint32_t *minhash = NULL;     // [u * MINHASH_SIZE + i]: smallest hash i over u's connections
+int *lsh_bucket = NULL;       // [band * n + u]: bucket of u in the band, -1 without connections
+int *lsh_postings = NULL;     // [band * (n + 1) + b]: bucket b of a band is lsh_members[band * n + ..]
+int *lsh_members = NULL;      // per band, users grouped by bucket in file order
+int sketch_users = 0;         // n of the arrays above
+bool sketches_valid = false;
+
+// Hashes x for sketch 'seed' (the murmur3 64-bit finalizer).
+static inline uint64_t sketch_hash(uint64_t x, uint64_t seed) {
+    uint64_t h = x ^ (seed * 0x9E3779B97F4A7C15ull);
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    return h ^ (h >> 33);
+}
+
+// Returns the HyperLogLog estimate of the number of distinct users counted by
+// 'registers'. 'powers[r]' is 2^-r.
+static double hll_estimate(const uint8_t *registers, const double *powers) {
+    double sum = 0.0;
+    int zeros = 0;
+    for (int j = 0; j < HLL_REGISTERS; j++) {
+        sum += powers[registers[j]];
+        zeros += registers[j] == 0;
+    }
+    double m = HLL_REGISTERS, estimate = 0.7213 / (1.0 + 1.079 / m) * m * m / sum;
+    if (estimate <= 2.5 * m && zeros > 0) estimate = m * log(m / zeros); // linear counting
+    return estimate;
+}
+
+// Estimates the reach of every user.
+static void compute_reach_estimates(int n) {
+    int bits = __builtin_ctz(HLL_REGISTERS);
+    double powers[66];
+    for (int r = 0; r < 66; r++) powers[r] = ldexp(1.0, -r);
+    uint8_t *current = xcalloc((size_t)n * HLL_REGISTERS + 1, 1);
+    uint8_t *next = xmalloc((size_t)n * HLL_REGISTERS + 1);
+    OMP(parallel for schedule(static))
+    for (int u = 0; u < n; u++) {
+        if (is_user_removed(u)) continue;
+        uint64_t h = sketch_hash((uint32_t)user_ids[u], 0);
+        uint64_t rest = (h << bits) | (1ull << (bits - 1)); // never all zero
+        current[(size_t)u * HLL_REGISTERS + (h >> (64 - bits))] = (uint8_t)(__builtin_clzll(rest) + 1);
+    }
+
+    free(reach_estimate);
+    reach_estimate = xmalloc(sizeof(float) * ((size_t)n * SKETCH_HOPS + 1));
+    bool changed = true;
+    for (int hops = 1; hops <= SKETCH_HOPS; hops++) {
+        // Once no counter grows, every further hop has the same estimates.
+        if (changed) {
+            changed = false;
+            OMP(parallel for schedule(dynamic, 1024) reduction(||:changed))
+            for (int u = 0; u < n; u++) {
+                uint8_t merged[HLL_REGISTERS]; // local, so the max below vectorizes
+                memcpy(merged, current + (size_t)u * HLL_REGISTERS, HLL_REGISTERS);
+                NeighbourCursor cursor = out_neighbours(u);
+                for (int v; next_neighbour(&cursor, &v);) {
+                    const uint8_t *in = current + (size_t)v * HLL_REGISTERS;
+                    for (int j = 0; j < HLL_REGISTERS; j++) merged[j] = in[j] > merged[j] ? in[j] : merged[j];
+                }
+                memcpy(next + (size_t)u * HLL_REGISTERS, merged, HLL_REGISTERS);
+                changed = changed || memcmp(merged, current + (size_t)u * HLL_REGISTERS, HLL_REGISTERS) != 0;
+            }
+            INSTRUMENT_COUNT(COUNTER_EDGES_SCANNED, edge_count);
+            uint8_t *swap = current;
+            current = next;
+            next = swap;
+        }
+        OMP(parallel for schedule(static))
+        for (int u = 0; u < n; u++) {
+            double estimate = is_user_removed(u) ? 0.0 : hll_estimate(current + (size_t)u * HLL_REGISTERS, powers) - 1.0;
+            reach_estimate[(size_t)u * SKETCH_HOPS + hops - 1] = estimate > 0.0 ? (float)estimate : 0.0f;
+        }
+    }
+    free(current);
+    free(next);
+}
+
+// Computes the MinHash signatures and LSH buckets of every user.
+static void compute_similarity_sketches(int n) {
+    free(minhash);
+    minhash = xmalloc(sizeof(uint32_t) * ((size_t)n * MINHASH_SIZE + 1));
+    uint32_t *keys = xmalloc(sizeof(uint32_t) * ((size_t)n * LSH_BANDS + 1));
+    // Hash i of a user is the top half of its ID hash times an odd multiplier
+    // (multiply-shift), so each connection is hashed once.
+    uint64_t multipliers[MINHASH_SIZE];
+    for (int i = 0; i < MINHASH_SIZE; i++) multipliers[i] = sketch_hash(i, 1) | 1;
+    OMP(parallel for schedule(dynamic, 1024))
+    for (int u = 0; u < n; u++) {
+        uint32_t *signature = minhash + (size_t)u * MINHASH_SIZE;
+        for (int i = 0; i < MINHASH_SIZE; i++) signature[i] = UINT32_MAX;
+        NeighbourCursor cursor = out_neighbours(u);
+        for (int v; next_neighbour(&cursor, &v);) {
+            uint64_t h = sketch_hash((uint32_t)user_ids[v], 2);
+            for (int i = 0; i < MINHASH_SIZE; i++) {
+                uint32_t hash = (uint32_t)((h * multipliers[i]) >> 32);
+                if (hash < signature[i]) signature[i] = hash;
+            }
+        }
+        for (int band = 0; band < LSH_BANDS; band++) {
+            uint64_t h = band;
+            for (int i = band * (MINHASH_SIZE / LSH_BANDS); i < (band + 1) * (MINHASH_SIZE / LSH_BANDS); i++)
+                h = h * 0x100000001B3ull ^ signature[i];
+            keys[(size_t)band * n + u] = (uint32_t)(sketch_hash(h, band + 3) >> 32);
+        }
+    }
+
+    // Each band is a posting list of buckets, built like the country index:
+    // users in file order, stably sorted by bucket key.
+    free(lsh_bucket);
+    free(lsh_postings);
+    free(lsh_members);
+    lsh_bucket = xmalloc(sizeof(int) * ((size_t)n * LSH_BANDS + 1));
+    lsh_postings = xmalloc(sizeof(int) * ((size_t)(n + 1) * LSH_BANDS));
+    lsh_members = xmalloc(sizeof(int) * ((size_t)n * LSH_BANDS + 1));
+    OMP(parallel for schedule(dynamic, 1))
+    for (int band = 0; band < LSH_BANDS; band++) {
+        int *members = lsh_members + (size_t)band * n, *postings = lsh_postings + (size_t)band * (n + 1);
+        int *bucket = lsh_bucket + (size_t)band * n;
+        const uint32_t *band_keys = keys + (size_t)band * n;
+        int count = 0, buckets = 0;
+        for (int r = 0; r < n; r++) {
+            int u = row_user(r);
+            bucket[u] = -1;
+            if (!is_user_removed(u) && out_degree(u) > 0) members[count++] = u;
+        }
+        radix_sort_indices(members, count, band_keys);
+        for (int i = 0; i < count; i++) {
+            if (i == 0 || band_keys[members[i]] != band_keys[members[i - 1]]) postings[buckets++] = i;
+            bucket[members[i]] = buckets - 1;
+        }
+        postings[buckets] = count;
+    }
+    free(keys);
+}
+
+// Computes the reach estimates and similarity sketches, unless they are current.
+void compute_sketches() {
+    if (sketches_valid) return;
+    INSTRUMENT_SPAN(OP_SKETCHES);
+    int n = user_count;
+    compute_reach_estimates(n);
+    compute_similarity_sketches(n);
+    sketch_users = n;
+    sketches_valid = true;
+}
+
+// Returns the estimated Jaccard similarity of the connections of users u and v.
+static inline double estimated_similarity(int u, int v) {
+    const uint32_t *a = minhash + (size_t)u * MINHASH_SIZE, *b = minhash + (size_t)v * MINHASH_SIZE;
+    int equal = 0;
+    for (int i = 0; i < MINHASH_SIZE; i++) equal += a[i] == b[i];
+    return (double)equal / MINHASH_SIZE;
+}
+
+// Writes up to k users whose connections are most similar to those of user
+// index 'user' to 'out', most similar first, with their estimated Jaccard
+// similarity. Only users sharing an LSH bucket with it are considered, at
+// most SIMILAR_CANDIDATES of them per band. Returns the number written.
+int similar_users(int user, int k, ScoredUser *out) {
+    INSTRUMENT_SPAN(OP_SIMILAR_USERS);
+    int n = sketch_users, count = 0;
+    if (k <= 0) return 0;
+    for (int band = 0; band < LSH_BANDS; band++) {
+        int b = lsh_bucket[(size_t)band * n + user];
+        if (b < 0) continue;
+        const int *postings = lsh_postings + (size_t)band * (n + 1), *members = lsh_members + (size_t)band * n;
+        int end = postings[b + 1];
+        if (end - postings[b] > SIMILAR_CANDIDATES) end = postings[b] + SIMILAR_CANDIDATES;
+        for (int i = postings[b]; i < end; i++) {
+            int v = members[i];
+            // A user met in an earlier band is either in 'out' already or
+            // ranked below all of it.
+            bool seen = v == user;
+            for (int j = 0; j < count && !seen; j++) seen = out[j].user == v;
+            if (seen) continue;
+            ScoredUser candidate = { v, estimated_similarity(user, v) };
+            if (count < k) {
+                out[count++] = candidate;
+            } else if (scored_better(&candidate, &out[k - 1])) {
+                out[k - 1] = candidate;
+            } else {
+                continue;
+            }
+            for (int j = count - 1; j > 0 && scored_better(&out[j], &out[j - 1]); j--) {
+                ScoredUser tmp = out[j];
+                out[j] = out[j - 1];
+                out[j - 1] = tmp;
+            }
+        }
+    }
+    return count;
+}
+
+// ---------------------------------------------------------------------------
+// Graph mutation
+//
+// Users and connections can be added and removed at runtime, and follower
+// counts and activity scores updated, without rebuilding anything: the
+// adjacency lists get spare room and move to the end of their array when
+// full, the hash indexes, rankings and country posting lists are patched in
+// place, weak components merge by union-find and strong components are only
+// invalidated when an edge could change them. All-pairs distances and hub
+// bitmaps for new users are dropped and rebuilt on next use, and PageRank is
+// recomputed on next use starting from the stale scores. Triangle counts,
+// communities and sketches are recomputed on next use.
+//
+// The first mutation detaches the graph from its input: strings move into an
+// owned pool and every array still pointing into a mapped snapshot is copied.
+// Removed users keep their slot until compact_graph() renumbers the rest.
+// ---------------------------------------------------------------------------
+
+// Growable adjacency in one direction: list v is (*targets)[(*starts)[v] ..
+// (*ends)[v]) with room up to (*limits)[v]. Slots past 'used' are free;
+// 'reserved' counts the slots that belong to some list, the rest are holes
+// left behind by lists that moved.
+typedef struct {
+    int **targets, **starts, **ends, **limits;
+    long long used, reserved, capacity;
+} ListSpace;
+
+ListSpace forward_lists = { &adj_targets, &adj_offsets, &adj_ends, &adj_limits, 0, 0, 0 };
+ListSpace reverse_lists = { &rev_targets, &rev_offsets, &rev_ends, &rev_limits, 0, 0, 0 };
+bool graph_mutable = false;
+
+// Returns a heap copy of an array that lives in the mapped snapshot, or the
+// array itself if it is already owned.
+static void *own_array(void *ptr, size_t size) {
+    if (!in_snapshot(ptr)) return ptr;
+    void *copy = xmalloc(size);
+    memcpy(copy, ptr, size);
+    return copy;
+}
+
+// Resizes every per-user array to hold 'capacity' users.
+static void resize_user_arrays(int capacity) {
+    size_t c = (size_t)(capacity ? capacity : 1);
+    user_ids = xrealloc(user_ids, sizeof(int) * c);
+    user_followers = xrealloc(user_followers, sizeof(int) * c);
+    user_activity = xrealloc(user_activity, sizeof(float) * c);
+    user_country_ids = xrealloc(user_country_ids, sizeof(uint16_t) * c);
+    user_name_offsets = xrealloc(user_name_offsets, sizeof(size_t) * c);
+    user_removed = xrealloc(user_removed, sizeof(bool) * c);
+    adj_offsets = xrealloc(adj_offsets, sizeof(int) * (c + 1));
+    adj_ends = xrealloc(adj_ends, sizeof(int) * c);
+    adj_limits = xrealloc(adj_limits, sizeof(int) * c);
+    rev_offsets = xrealloc(rev_offsets, sizeof(int) * (c + 1));
+    rev_ends = xrealloc(rev_ends, sizeof(int) * c);
+    rev_limits = xrealloc(rev_limits, sizeof(int) * c);
+    name_next = xrealloc(name_next, sizeof(int) * c);
+    follower_order = xrealloc(follower_order, sizeof(int) * c);
+    activity_order = xrealloc(activity_order, sizeof(int) * c);
+    country_by_followers = xrealloc(country_by_followers, sizeof(int) * c);
+    country_by_activity = xrealloc(country_by_activity, sizeof(int) * c);
+    if (scc_id) scc_id = xrealloc(scc_id, sizeof(int) * c);
+    if (wcc_id) wcc_id = xrealloc(wcc_id, sizeof(int) * c);
+    if (user_rows) {
+        user_rows = xrealloc(user_rows, sizeof(int) * c);
+        row_users = xrealloc(row_users, sizeof(int) * c);
+    }
+    for (int i = user_capacity; i < capacity; i++) user_removed[i] = false;
+    user_capacity = capacity;
+}
+
+// Appends a string to the owned string pool and returns its offset.
+static size_t append_string(const char *str) {
+    size_t length = strlen(str);
+    if (string_pool_size + length + 1 > string_pool_capacity) {
+        while (string_pool_size + length + 1 > string_pool_capacity)
+            string_pool_capacity = string_pool_capacity ? string_pool_capacity * 2 : 4096;
+        string_pool = xrealloc(string_pool, string_pool_capacity);
+    }
+    size_t offset = string_pool_size;
+    memcpy(string_pool + offset, str, length + 1);
+    string_pool_size += length + 1;
+    return offset;
+}
+
+// Detaches the graph from the CSV mapping or snapshot so it can be changed.
+// Called by every mutation; only the first call does any work.
+void make_graph_mutable() {
+    if (graph_mutable) return;
+    decompress_graph();
+
+    // Copy names and countries into an owned pool of distinct strings.
+    if (string_pool_capacity == 0) {
+        StringTable strings = { 0 };
+        strings.mask = index_table_size(user_count * 2 + countries.count) - 1;
+        strings.slots = xcalloc((size_t)strings.mask + 1, sizeof(uint64_t));
+        size_t *name_offsets = xmalloc(sizeof(size_t) * (user_count ? user_count : 1));
+        size_t *country_offsets = xmalloc(sizeof(size_t) * (countries.count ? countries.count : 1));
+        for (int i = 0; i < user_count; i++) name_offsets[i] = intern_string(&strings, user_name(i));
+        for (int c = 0; c < countries.count; c++) country_offsets[c] = intern_string(&strings, country_name(c));
+        free(strings.slots);
+
+        if (!snapshot_data) unmap_file(string_pool, string_pool_size); // the CSV mapping
+        free_owned(user_name_offsets);
+        free_owned(countries.offsets);
+        user_name_offsets = name_offsets;
+        countries.offsets = country_offsets;
+        countries.capacity = countries.count;
+        string_pool = strings.data ? strings.data : xmalloc(1);
+        string_pool_size = strings.size;
+        string_pool_capacity = strings.capacity ? strings.capacity : 1;
+    }
+
+    if (snapshot_data) {
+        size_t n = (size_t)user_count, m = (size_t)edge_count;
+        user_ids = own_array(user_ids, sizeof(int) * n);
+        user_followers = own_array(user_followers, sizeof(int) * n);
+        user_activity = own_array(user_activity, sizeof(float) * n);
+        user_country_ids = own_array(user_country_ids, sizeof(uint16_t) * n);
+        adj_offsets = own_array(adj_offsets, sizeof(int) * (n + 1));
+        adj_targets = own_array(adj_targets, sizeof(int) * m);
+        rev_offsets = own_array(rev_offsets, sizeof(int) * (n + 1));
+        rev_targets = own_array(rev_targets, sizeof(int) * m);
+        id_index = own_array(id_index, sizeof(IdSlot) * ((size_t)id_index_mask + 1));
+        name_index = own_array(name_index, sizeof(NameSlot) * ((size_t)name_index_mask + 1));
+        name_next = own_array(name_next, sizeof(int) * n);
+        if (countries.slots) countries.slots = own_array(countries.slots, sizeof(NameSlot) * ((size_t)countries.mask + 1));
+        follower_order = own_array(follower_order, sizeof(int) * n);
+        activity_order = own_array(activity_order, sizeof(int) * n);
+        country_postings = own_array(country_postings, sizeof(int) * (countries.count + 1));
+        country_by_followers = own_array(country_by_followers, sizeof(int) * n);
+        country_by_activity = own_array(country_by_activity, sizeof(int) * n);
+        if (user_rows) {
+            user_rows = own_array(user_rows, sizeof(int) * n);
+            row_users = own_array(row_users, sizeof(int) * n);
+        }
+        unmap_file(snapshot_data, snapshot_size);
+        snapshot_data = NULL;
+        snapshot_size = 0;
+    }
+
+    // Switch the packed lists to growable ones with no spare room yet.
+    int capacity = user_count;
+    user_capacity = 0;
+    resize_user_arrays(capacity);
+    for (int v = 0; v < user_count; v++) {
+        adj_ends[v] = adj_limits[v] = adj_offsets[v + 1];
+        rev_ends[v] = rev_limits[v] = rev_offsets[v + 1];
+    }
+    forward_lists.used = forward_lists.reserved = forward_lists.capacity = edge_count;
+    reverse_lists.used = reverse_lists.reserved = reverse_lists.capacity = edge_count;
+    edge_capacity = edge_count;
+    graph_mutable = true;
+}
+
+// Moves every list of a space into a fresh array with no holes, keeping the
+// room each list has, plus 'extra' free slots at the end.
+static void list_space_repack(ListSpace *space, long long extra) {
+    int *starts = *space->starts, *ends = *space->ends, *limits = *space->limits;
+    long long capacity = space->reserved + extra;
+    if (capacity > INT_MAX) {
+        printf("Too many connections!\n");
+        exit(1);
+    }
+    int *targets = xmalloc(sizeof(int) * (size_t)(capacity ? capacity : 1));
+    int write = 0;
+    for (int v = 0; v < user_count; v++) {
+        int length = ends[v] - starts[v], room = limits[v] - starts[v];
+        memcpy(targets + write, *space->targets + starts[v], sizeof(int) * length);
+        starts[v] = write;
+        ends[v] = write + length;
+        limits[v] = write + room;
+        write += room;
+    }
+    free(*space->targets);
+    *space->targets = targets;
+    space->used = write;
+    space->capacity = capacity;
+}
+
+// Makes sure list v has room for one more entry. A full list moves to the
+// free end of the array with twice its length in room.
+static void list_reserve_one(ListSpace *space, int v) {
+    if ((*space->ends)[v] < (*space->limits)[v]) return;
+    int length = (*space->ends)[v] - (*space->starts)[v];
+    int room = length < 4 ? 4 : length * 2;
+    if (space->used + room > space->capacity) {
+        if (space->used - space->reserved > space->reserved / 2) {
+            list_space_repack(space, space->reserved / 2 + room);
+        } else {
+            long long capacity = space->capacity * 2 > space->used + room ? space->capacity * 2 : space->used + room;
+            if (capacity > INT_MAX) capacity = INT_MAX;
+            if (space->used + room > capacity) {
+                printf("Too many connections!\n");
+                exit(1);
+            }
+            *space->targets = xrealloc(*space->targets, sizeof(int) * (size_t)capacity);
+            space->capacity = capacity;
+        }
+    }
+    int *starts = *space->starts, *ends = *space->ends, *limits = *space->limits;
+    int start = (int)space->used;
+    memcpy(*space->targets + start, *space->targets + starts[v], sizeof(int) * length);
+    space->reserved += room - (limits[v] - starts[v]);
+    starts[v] = start;
+    ends[v] = start + length;
+    limits[v] = start + room;
+    space->used += room;
+}
+
+// Returns the position of w in list v, or where it would be inserted.
+static int list_lower_bound(const ListSpace *space, int v, int w) {
+    const int *targets = *space->targets;
+    int lo = (*space->starts)[v], hi = (*space->ends)[v];
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (targets[mid] < w) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Inserts w into the sorted list v. Returns false if it is already there.
+static bool list_insert(ListSpace *space, int v, int w) {
+    int position = list_lower_bound(space, v, w);
+    if (position < (*space->ends)[v] && (*space->targets)[position] == w) return false;
+    int offset = position - (*space->starts)[v];
+    list_reserve_one(space, v);
+    int *list = *space->targets + (*space->starts)[v];
+    int length = (*space->ends)[v] - (*space->starts)[v];
+    memmove(list + offset + 1, list + offset, sizeof(int) * (length - offset));
+    list[offset] = w;
+    (*space->ends)[v]++;
+    return true;
+}
+
+// Removes w from the sorted list v. Returns false if it is not there.
+static bool list_remove(ListSpace *space, int v, int w) {
+    int position = list_lower_bound(space, v, w);
+    int end = (*space->ends)[v];
+    if (position == end || (*space->targets)[position] != w) return false;
+    memmove(*space->targets + position, *space->targets + position + 1, sizeof(int) * (end - position - 1));
+    (*space->ends)[v]--;
+    return true;
+}
+
+// Adds user i to the ID and name indexes, rebuilding them when they get too full.
+static void index_insert_user(int i) {
+    if ((uint32_t)live_user_count() * 2 > id_index_mask + 1) {
+        build_indexes();
+        return;
+    }
+    uint32_t s = hash_id(user_ids[i]) & id_index_mask;
+    while (id_index[s].index != -1) s = (s + 1) & id_index_mask;
+    id_index[s].id = user_ids[i];
+    id_index[s].index = i;
+
+    // i has the last row, so it goes at the end of its name chain.
+    name_next[i] = -1;
+    uint32_t h = hash_name(user_name(i));
+    s = h & name_index_mask;
+    while (name_index[s].index != -1 &&
+           (name_index[s].hash != h || strcasecmp(user_name(name_index[s].index), user_name(i)) != 0))
+        s = (s + 1) & name_index_mask;
+    if (name_index[s].index == -1) {
+        name_index[s].hash = h;
+        name_index[s].index = i;
+    } else {
+        int tail = name_index[s].index;
+        while (name_next[tail] != -1) tail = name_next[tail];
+        name_next[tail] = i;
+    }
+}
+
+// Empties slot s of a linear-probing ID index, shifting later entries of the
+// same probe run back so no tombstone is needed.
+static void id_index_delete(uint32_t s) {
+    uint32_t hole = s;
+    for (uint32_t next = (s + 1) & id_index_mask; id_index[next].index != -1; next = (next + 1) & id_index_mask) {
+        uint32_t home = hash_id(id_index[next].id) & id_index_mask;
+        if (((next - home) & id_index_mask) >= ((next - hole) & id_index_mask)) {
+            id_index[hole] = id_index[next];
+            hole = next;
+        }
+    }
+    id_index[hole].index = -1;
+}
+
+// Empties slot s of the name index the same way.
+static void name_index_delete(uint32_t s) {
+    uint32_t hole = s;
+    for (uint32_t next = (s + 1) & name_index_mask; name_index[next].index != -1; next = (next + 1) & name_index_mask) {
+        uint32_t home = name_index[next].hash & name_index_mask;
+        if (((next - home) & name_index_mask) >= ((next - hole) & name_index_mask)) {
+            name_index[hole] = name_index[next];
+            hole = next;
+        }
+    }
+    name_index[hole].index = -1;
+}
+
+// Removes user i from the ID and name indexes.
+static void index_remove_user(int i) {
+    for (uint32_t s = hash_id(user_ids[i]) & id_index_mask; id_index[s].index != -1; s = (s + 1) & id_index_mask) {
+        if (id_index[s].index == i) {
+            id_index_delete(s);
+            break;
+        }
+    }
+
+    uint32_t h = hash_name(user_name(i));
+    for (uint32_t s = h & name_index_mask; name_index[s].index != -1; s = (s + 1) & name_index_mask) {
+        int head = name_index[s].index;
+        if (name_index[s].hash != h || strcasecmp(user_name(head), user_name(i)) != 0) continue;
+        if (head == i) {
+            if (name_next[i] != -1) name_index[s].index = name_next[i];
+            else name_index_delete(s);
+        } else {
+            while (name_next[head] != i) head = name_next[head];
+            name_next[head] = name_next[i];
+        }
+        break;
+    }
+}
+
+// Adds user u to the rankings and its country's posting lists, which hold
+// 'ranked' users before the call. Later countries shift up by one slot.
+static void rankings_insert_user(int u, int ranked) {
+    int c = user_country_ids[u];
+    int begin = country_begin(c), end = country_end(c);
+    ranking_insert(follower_order, ranked, u, compareIndicesByFollowers);
+    ranking_insert(activity_order, ranked, u, compareIndicesByActivity);
+    memmove(country_by_followers + end + 1, country_by_followers + end, sizeof(int) * (ranked - end));
+    memmove(country_by_activity + end + 1, country_by_activity + end, sizeof(int) * (ranked - end));
+    ranking_insert(country_by_followers + begin, end - begin, u, compareIndicesByFollowers);
+    ranking_insert(country_by_activity + begin, end - begin, u, compareIndicesByActivity);
+    for (int k = c + 1; k <= countries.count; k++) country_postings[k]++;
+}
+
+// Removes user u from the rankings and posting lists ('ranked' users before the call).
+static void rankings_remove_user(int u, int ranked) {
+    int c = user_country_ids[u];
+    int begin = country_begin(c), end = country_end(c);
+    ranking_remove(follower_order, ranked, ranking_find(follower_order, ranked, u, compareIndicesByFollowers));
+    ranking_remove(activity_order, ranked, ranking_find(activity_order, ranked, u, compareIndicesByActivity));
+    int position = begin + ranking_find(country_by_followers + begin, end - begin, u, compareIndicesByFollowers);
+    memmove(country_by_followers + position, country_by_followers + position + 1, sizeof(int) * (ranked - position - 1));
+    position = begin + ranking_find(country_by_activity + begin, end - begin, u, compareIndicesByActivity);
+    memmove(country_by_activity + position, country_by_activity + position + 1, sizeof(int) * (ranked - position - 1));
+    for (int k = c + 1; k <= countries.count; k++) country_postings[k]--;
+}
+
+// Adds a user with the given details. Returns its index, or -1 if the ID is
+// already taken or there are too many distinct countries.
+int add_user(int id, const char *name, int followers, float activity, const char *country) {
+    INSTRUMENT_SPAN(OP_ADD_USER);
+    make_graph_mutable();
+    if (find_user_by_id(id) != -1) return -1;
+
+    int code = find_country(country);
+    if (code == -1) {
+        if (countries.count == MAX_COUNTRIES) return -1;
+        code = country_table_intern(&countries, append_string(country));
+        country_postings = xrealloc(country_postings, sizeof(int) * (countries.count + 1));
+        country_postings[countries.count] = country_postings[countries.count - 1];
+    }
+    if (user_count == INT_MAX - 1) return -1;
+    if (user_count == user_capacity) resize_user_arrays(user_capacity * 2 > 16 ? user_capacity * 2 : 16);
+
+    int u = user_count++;
+    user_ids[u] = id;
+    user_followers[u] = followers;
+    user_activity[u] = activity;
+    user_country_ids[u] = (uint16_t)code;
+    user_name_offsets[u] = append_string(name);
+    user_removed[u] = false;
+    if (user_rows) user_rows[u] = row_users[u] = u;
+    adj_offsets[u] = adj_ends[u] = adj_limits[u] = (int)forward_lists.used;
+    rev_offsets[u] = rev_ends[u] = rev_limits[u] = (int)reverse_lists.used;
+
+    rankings_insert_user(u, live_user_count() - 1);
+    index_insert_user(u);
+
+    // A new user is a component of its own; as it has no edges yet, giving it
+    // the highest scc id keeps the reverse topological numbering.
+    if (scc_valid) {
+        scc_size = xrealloc(scc_size, sizeof(int) * (scc_count + 1));
+        scc_id[u] = scc_count;
+        scc_size[scc_count++] = 1;
+    }
+    if (wcc_valid) {
+        wcc_parent = xrealloc(wcc_parent, sizeof(int) * (wcc_labels + 1));
+        wcc_size = xrealloc(wcc_size, sizeof(int) * (wcc_labels + 1));
+        wcc_id[u] = wcc_labels;
+        wcc_parent[wcc_labels] = wcc_labels;
+        wcc_size[wcc_labels++] = 1;
+        wcc_count++;
+    }
+    hub_bits_valid = false;
+    apsp_valid = false;
+    pagerank_valid = false;
+    communities_valid = triangles_valid = sketches_valid = false;
+    return u;
+}
+
+// Adds the connection u -> v. Returns false if it already exists or either
+// user is invalid.
+bool add_connection(int u, int v) {
+    INSTRUMENT_SPAN(OP_ADD_CONNECTION);
+    if (u < 0 || v < 0 || u >= user_count || v >= user_count || is_user_removed(u) || is_user_removed(v)) return false;
+    make_graph_mutable();
+    if (!list_insert(&forward_lists, u, v)) return false;
+    list_insert(&reverse_lists, v, u);
+    edge_count++;
+
+    // Edges from a higher to a lower scc id keep the components and their
+    // order; anything else may close a cycle.
+    if (scc_valid && scc_id[u] < scc_id[v]) scc_valid = false;
+    if (wcc_valid) {
+        int a = weak_component(u), b = weak_component(v);
+        if (a != b) {
+            if (wcc_size[a] < wcc_size[b]) {
+                int tmp = a;
+                a = b;
+                b = tmp;
+            }
+            wcc_parent[b] = a;
+            wcc_size[a] += wcc_size[b];
+            wcc_count--;
+        }
+    }
+    if (hub_bits_valid) {
+        if (hub_bits[u]) bit_set(hub_bits[u], v);
+        if (out_degree(u) > max_out_degree) max_out_degree = out_degree(u);
+    }
+    apsp_valid = false;
+    pagerank_valid = false;
+    communities_valid = triangles_valid = sketches_valid = false;
+    return true;
+}
+
+// Removes the connection u -> v. Returns false if it does not exist.
+bool remove_connection(int u, int v) {
+    INSTRUMENT_SPAN(OP_REMOVE_CONNECTION);
+    if (u < 0 || v < 0 || u >= user_count || v >= user_count) return false;
+    make_graph_mutable();
+    if (!list_remove(&forward_lists, u, v)) return false;
+    list_remove(&reverse_lists, v, u);
+    edge_count--;
+
+    if (scc_valid && scc_id[u] == scc_id[v]) scc_valid = false;
+    wcc_valid = false;
+    if (hub_bits_valid && hub_bits[u]) hub_bits[u][v >> 6] &= ~(1ULL << (v & 63));
+    apsp_valid = false;
+    pagerank_valid = false;
+    communities_valid = triangles_valid = sketches_valid = false;
+    return true;
+}
+
+// Removes user u with all of its connections. Returns false if u is invalid
+// or already removed.
+bool remove_user(int u) {
+    INSTRUMENT_SPAN(OP_REMOVE_USER);
+    if (u < 0 || u >= user_count || is_user_removed(u)) return false;
+    make_graph_mutable();
+    while (adj_ends[u] > adj_offsets[u]) remove_connection(u, adj_targets[adj_ends[u] - 1]);
+    while (rev_ends[u] > rev_offsets[u]) remove_connection(rev_targets[rev_ends[u] - 1], u);
+
+    rankings_remove_user(u, live_user_count());
+    index_remove_user(u);
+    user_removed[u] = true;
+    removed_user_count++;
+    pagerank_valid = false;
+    communities_valid = triangles_valid = sketches_valid = false;
+    return true;
+}
+
+// Drops removed users and packs the adjacency back into plain CSR, keeping
+// the remaining users in their current order (and file rows in file order).
+// Every index is rebuilt and cached components are recomputed on next use.
+// Run before writing a snapshot.
+void compact_graph() {
+    INSTRUMENT_SPAN(OP_COMPACT);
+    if (!graph_mutable) return;
+    int n = user_count;
+    int *remap = xmalloc(sizeof(int) * (n ? n : 1));
+    int live = 0;
+    for (int i = 0; i < n; i++) remap[i] = is_user_removed(i) ? -1 : live++;
+
+    // Remapping is monotonic, so every list stays sorted.
+    int *offsets = xmalloc(sizeof(int) * (user_capacity + 1));
+    int *targets = xmalloc(sizeof(int) * (edge_count ? edge_count : 1));
+    int write = 0;
+    offsets[0] = 0;
+    for (int i = 0; i < n; i++) {
+        if (remap[i] < 0) continue;
+        for (int e = adj_begin(i); e < adj_end(i); e++) targets[write++] = remap[adj_targets[e]];
+        offsets[remap[i] + 1] = write;
+    }
+    int scored = 0;
+    for (int i = 0; i < n; i++) {
+        int j = remap[i];
+        if (j < 0) continue;
+        if (i < pagerank_users) {
+            pagerank[j] = pagerank[i]; // kept as the starting point of the next computation
+            scored = j + 1;
+        }
+        user_ids[j] = user_ids[i];
+        user_followers[j] = user_followers[i];
+        user_activity[j] = user_activity[i];
+        user_country_ids[j] = user_country_ids[i];
+        user_name_offsets[j] = user_name_offsets[i];
+    }
+    if (user_rows) {
+        for (int r = 0, row = 0; r < n; r++) {
+            int i = row_users[r];
+            if (remap[i] < 0) continue;
+            user_rows[remap[i]] = row;
+            row_users[row++] = remap[i];
+        }
+    }
+    free(remap);
+
+    free(adj_offsets);
+    free(adj_targets);
+    free(adj_ends);
+    free(adj_limits);
+    free(rev_ends);
+    free(rev_limits);
+    adj_offsets = offsets;
+    adj_targets = targets;
+    adj_ends = adj_limits = rev_ends = rev_limits = NULL;
+    free(user_removed);
+    user_removed = NULL;
+    removed_user_count = 0;
+    user_count = live;
+    edge_count = edge_capacity = write;
+
+    build_reverse_graph();
+    build_indexes();
+    build_secondary_indexes();
+    pagerank_users = scored;
+    scc_valid = wcc_valid = false;
+    hub_bits_valid = false;
+    apsp_valid = false;
+    pagerank_valid = false;
+    communities_valid = triangles_valid = sketches_valid = false;
+    graph_mutable = false;
+}
+
+// ---------------------------------------------------------------------------
+// Friend recommendations
+//
+// Candidates are the friends-of-friends of a user. Only the two-hop
+// neighbourhood is walked: mutual counts go into a sparse accumulator (a
+// dense counter array plus the list of touched entries, which is reset after
+// each query), and the best k candidates are kept in a bounded min-heap.
+// ---------------------------------------------------------------------------
+
+#define RECOMMENDATION_COUNT 5
+
+// One recommended user.
+typedef struct {
+    int user;     // candidate user index
+    int mutuals;  // connections of the user that list the candidate
+    double score; // ranking score (see recommendation_score)
+} Recommendation;
+
+// Optional score boosts on top of the mutual count. Zero weights rank by
+// mutual connections alone.
+typedef struct {
+    double follower_weight; // multiplied by log10(1 + followers)
+    double activity_weight; // multiplied by activity_score
+} RecommendWeights;
+
+// Reusable per-thread buffers for recommendation queries.
+typedef struct {
+    int *count;   // mutuals per candidate; 0 = untouched, -1 = excluded
+    int *touched; // entries of 'count' to reset after the query
+    int capacity;
+} RecommendWorkspace;
+
+// Makes sure the workspace can hold 'n' users.
+void recommend_workspace_reserve(RecommendWorkspace *ws, int n) {
+    if (ws->capacity >= n) return;
+    free(ws->count);
+    free(ws->touched);
+    ws->count = xcalloc(n, sizeof(int));
+    ws->touched = xmalloc(sizeof(int) * n);
+    ws->capacity = n;
+}
+
+// Releases the workspace buffers.
+void recommend_workspace_free(RecommendWorkspace *ws) {
+    free(ws->count);
+    free(ws->touched);
+    memset(ws, 0, sizeof(*ws));
+}
+
+// Returns the ranking score of a candidate with the given mutual count.
+static double recommendation_score(int candidate, int mutuals, const RecommendWeights *weights) {
+    double score = mutuals;
+    if (weights) {
+        score += weights->follower_weight * log10(1.0 + user_followers[candidate]);
+        score += weights->activity_weight * user_activity[candidate];
+    }
+    return score;
+}
+
+// Returns true if recommendation a ranks above b (higher score, then more
+// mutuals, then earlier in the file).
+static inline bool recommendation_better(const Recommendation *a, const Recommendation *b) {
+    if (a->score != b->score) return a->score > b->score;
+    if (a->mutuals != b->mutuals) return a->mutuals > b->mutuals;
+    return compare_rows(a->user, b->user) < 0;
+}
+
+// Restores the min-heap property (worst recommendation at the root) below 'i'.
+static void recommendation_sift_down(Recommendation *heap, int size, int i) {
+    while (true) {
+        int worst = i, left = 2 * i + 1, right = left + 1;
+        if (left < size && recommendation_better(&heap[worst], &heap[left])) worst = left;
+        if (right < size && recommendation_better(&heap[worst], &heap[right])) worst = right;
+        if (worst == i) return;
+        Recommendation tmp = heap[i];
+        heap[i] = heap[worst];
+        heap[worst] = tmp;
+        i = worst;
+    }
+}
+
+// Computes up to k recommendations for user index 'user' into 'out', best
+// first. 'weights' may be NULL. Returns the number of recommendations.
+int recommend_for_user(RecommendWorkspace *ws, int user, int k, const RecommendWeights *weights, Recommendation *out) {
+    INSTRUMENT_SPAN(OP_RECOMMEND);
+    recommend_workspace_reserve(ws, user_count);
+    int *count = ws->count;
+    int touched = 0;
+
+    count[user] = -1;
+    ws->touched[touched++] = user;
+    NeighbourCursor friends = out_neighbours(user);
+    for (int friend_index; next_neighbour(&friends, &friend_index);) {
+        if (count[friend_index] == 0) ws->touched[touched++] = friend_index;
+        count[friend_index] = -1;
+    }
+
+    // Each friend-of-a-friend gains one mutual friend per friend that links to it.
+    friends = out_neighbours(user);
+    for (int friend_index; next_neighbour(&friends, &friend_index);) {
+        INSTRUMENT_COUNT(COUNTER_EDGES_SCANNED, out_degree(friend_index));
+        NeighbourCursor cursor = out_neighbours(friend_index);
+        for (int candidate; next_neighbour(&cursor, &candidate);) {
+            if (count[candidate] < 0) continue;
+            if (count[candidate]++ == 0) ws->touched[touched++] = candidate;
+        }
+    }
+
+    INSTRUMENT_COUNT(COUNTER_VERTICES_VISITED, touched);
+    int size = 0;
+    for (int t = 0; t < touched; t++) {
+        int candidate = ws->touched[t];
+        if (count[candidate] > 0 && k > 0) {
+            Recommendation r = { candidate, count[candidate], recommendation_score(candidate, count[candidate], weights) };
+            if (size < k) {
+                out[size++] = r;
+                if (size == k) {
+                    for (int i = k / 2 - 1; i >= 0; i--) recommendation_sift_down(out, size, i);
+                }
+            } else if (recommendation_better(&r, &out[0])) {
+                out[0] = r;
+                recommendation_sift_down(out, size, 0);
+            }
+        }
+        count[candidate] = 0;
+    }
+
+    // Sort the kept candidates best first (insertion sort; k is small).
+    for (int i = 1; i < size; i++) {
+        Recommendation r = out[i];
+        int j = i - 1;
+        for (; j >= 0 && recommendation_better(&r, &out[j]); j--) out[j + 1] = out[j];
+        out[j + 1] = r;
+    }
+    return size;
+}
+
+// Computes up to k recommendations for every user index in [first, last),
+// in parallel. Results for user u are written to out[(u - first) * k ...]
+// with their count in out_counts[u - first].
+void recommend_for_range(int first, int last, int k, const RecommendWeights *weights,
+                         Recommendation *out, int *out_counts) {
+    OMP(parallel)
+    {
+        RecommendWorkspace ws = { 0 };
+        OMP(for schedule(dynamic, 256))
+        for (int u = first; u < last; u++) {
+            out_counts[u - first] = recommend_for_user(&ws, u, k, weights, out + (size_t)(u - first) * k);
+        }
+        recommend_workspace_free(&ws);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Query API
+//
+// The functions below answer queries into caller-provided buffers and never
+// print; the menu and batch mode are thin consumers of them. The loaded graph
+// is process-wide and only read by queries, while all scratch state lives in
+// a QueryContext, so threads with separate contexts can query concurrently.
+// Shared caches (components, hub bitmaps, PageRank, communities, triangles)
+// are built on first use: call prepare_concurrent_queries() before querying
+// from several threads, and do not mutate the graph while queries run. A
+// zero-initialized QueryContext is ready to use; release it with
+// query_context_free().
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    BfsWorkspace bfs;
+    PathWorkspace path;
+    RecommendWorkspace recommend;
+    PushWorkspace push;
+    int *levels;       // BFS level of each user
+    int levels_capacity;
+    int *scratch;      // see query_scratch()
+    int scratch_capacity;
+    bool parallel;     // use OpenMP inside single queries on large graphs
+} QueryContext;
+
+// One node of an influence tree, listed in preorder.
+typedef struct {
+    int user;   // user index
+    int parent; // position of the parent node, -1 for the root
+    int depth;  // 0 for the root
+    bool last;  // last child of its parent
+} TreeNode;
+
+// How fragmented the network is and where one user sits in it.
+typedef struct {
+    int strong_components, weak_components;
+    int largest_strong, largest_weak;
+    int isolated;                         // users with no path to or from anyone
+    int user_strong_size, user_weak_size; // components containing the user
+} ComponentSummary;
+
+// Where one user sits in the network's structure.
+typedef struct {
+    long long triangles;
+    double clustering;             // local clustering coefficient
+    int community, community_size;
+} UserStructure;
+
+// Releases the buffers of a context.
+void query_context_free(QueryContext *ctx) {
+    bfs_workspace_free(&ctx->bfs);
+    path_workspace_free(&ctx->path);
+    recommend_workspace_free(&ctx->recommend);
+    push_workspace_free(&ctx->push);
+    free(ctx->levels);
+    free(ctx->scratch);
+    bool parallel = ctx->parallel;
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->parallel = parallel;
+}
+
+// Returns a scratch array of the context with room for n ints. The contents
+// are undefined and are reused by the next call.
+int *query_scratch(QueryContext *ctx, int n) {
+    if (ctx->scratch_capacity < n) {
+        free(ctx->scratch);
+        ctx->scratch = xmalloc(sizeof(int) * (n > 0 ? n : 1));
+        ctx->scratch_capacity = n;
+    }
+    return ctx->scratch;
+}
+
+// Builds every lazily computed cache so that queries only read shared state.
+void prepare_concurrent_queries() {
+    compute_components();
+    prepare_intersections();
+    compute_pagerank();
+    compute_communities();
+    compute_triangles();
+    compute_sketches();
+}
+
+static inline bool query_parallel(const QueryContext *ctx) {
+    return ctx->parallel && user_count >= BFS_PARALLEL_MIN_USERS;
+}
+
+// Writes the users reachable from user index 'source' to 'order' (room for
+// user_count users) in BFS order: by hop count, then by index. Returns how
+// many users were written, including the source.
+int query_bfs(QueryContext *ctx, int source, int *order) {
+    int n = user_count;
+    if (ctx->levels_capacity < n) {
+        free(ctx->levels);
+        ctx->levels = xmalloc(sizeof(int) * n);
+        ctx->levels_capacity = n;
+    }
+    int *levels = ctx->levels;
+    bfs_levels(&ctx->bfs, source, -1, levels, NULL, NULL, query_parallel(ctx));
+
+    // Counting sort by level keeps the output in BFS order.
+    int max_level = 0;
+    for (int v = 0; v < n; v++)
+        if (levels[v] > max_level) max_level = levels[v];
+    int *level_start = query_scratch(ctx, max_level + 2);
+    memset(level_start, 0, sizeof(int) * (max_level + 2));
+    for (int v = 0; v < n; v++)
+        if (levels[v] >= 0) level_start[levels[v] + 1]++;
+    for (int l = 0; l <= max_level; l++) level_start[l + 1] += level_start[l];
+    int reached = level_start[max_level + 1];
+    for (int v = 0; v < n; v++)
+        if (levels[v] >= 0) order[level_start[levels[v]]++] = v;
+    return reached;
+}
+
+// Writes the depth-first preorder from user index 'source' to 'order' (room
+// for user_count users). Returns how many users were written.
+int query_dfs(QueryContext *ctx, int source, int *order) {
+    return dfs_preorder(&ctx->bfs, source, order);
+}
+
+// Sets counts[h - 1] to the number of users within h connections of user
+// index 'source' (excluding the source), for h = 1 .. hops. One BFS answers
+// every hop count.
+void query_reach(QueryContext *ctx, int source, int hops, int *counts) {
+    int *sizes = query_scratch(ctx, hops + 1);
+    memset(sizes, 0, sizeof(int) * (hops + 1));
+    bfs_levels(&ctx->bfs, source, hops, NULL, NULL, sizes, query_parallel(ctx));
+    int total = 0;
+    for (int h = 1; h <= hops; h++) {
+        total += sizes[h];
+        counts[h - 1] = total;
+    }
+}
+
+// Finds a shortest path between user indices 'source' and 'target'. Writes it
+// to 'path' (room for hops + 1 users, at most user_count; may be NULL), source
+// first, and returns the number of hops, or -1 if there is no path.
+int query_shortest_path(QueryContext *ctx, int source, int target, int *path) {
+    int hops = shortest_path(&ctx->path, source, target);
+    if (path && hops >= 0) memcpy(path, ctx->path.path, sizeof(int) * (hops + 1));
+    return hops;
+}
+
+// Returns true if user index 'to' can be reached from 'from'.
+bool query_reachable(QueryContext *ctx, int from, int to) {
+    return can_reach_with(&ctx->path, from, to);
+}
+
+// Fills 'out' with the connectivity figures of the network and of user index 'user'.
+void query_components(int user, ComponentSummary *out) {
+    compute_components();
+    memset(out, 0, sizeof(*out));
+    for (int c = 0; c < scc_count; c++)
+        if (scc_size[c] > out->largest_strong) out->largest_strong = scc_size[c];
+    for (int c = 0; c < wcc_labels; c++) {
+        if (wcc_parent[c] != c) continue;
+        if (wcc_size[c] > out->largest_weak) out->largest_weak = wcc_size[c];
+        if (wcc_size[c] == 1) out->isolated++;
+    }
+    // Removed users linger as isolated single-user components until compaction.
+    out->isolated -= removed_user_count;
+    out->strong_components = scc_count - removed_user_count;
+    out->weak_components = wcc_count - removed_user_count;
+    out->user_strong_size = scc_size[scc_id[user]];
+    out->user_weak_size = wcc_size[weak_component(user)];
+}
+
+// Comparison function for sorting user indices by file row.
+static int compareIndicesByRow(const void *a, const void *b) {
+    return compare_rows(*(const int *)a, *(const int *)b);
+}
+
+// Scores the pair of user indices u and v into 'pair' and writes their mutual
+// connections to 'out' in file order (room for min(out_degree(u),
+// out_degree(v)) users; NULL to use context scratch). Returns the mutual count.
+int query_mutuals(QueryContext *ctx, int u, int v, PairSimilarity *pair, int *out) {
+    prepare_intersections();
+    if (!out) out = query_scratch(ctx, out_degree(u) < out_degree(v) ? out_degree(u) : out_degree(v));
+    pair->u = u;
+    pair->v = v;
+    pair_similarity(pair, out);
+    // Intersections come out by user index, which is only file order unreordered.
+    if (user_rows) qsort(out, pair->mutual_count, sizeof(int), compareIndicesByRow);
+    return pair->mutual_count;
+}
+
+// recommend_for_user() with the context's workspace.
+int query_recommend(QueryContext *ctx, int user, int k, const RecommendWeights *weights, Recommendation *out) {
+    return recommend_for_user(&ctx->recommend, user, k, weights, out);
+}
+
+// Writes up to k users with the highest personalized PageRank from user index
+// 'user' to 'out', best first. Returns the number of users written.
+int query_personalized_pagerank(QueryContext *ctx, int user, int k, ScoredUser *out) {
+    return personalized_pagerank(&ctx->push, user, k, out);
+}
+
+// Returns the users of a community, most followers first, and sets *count.
+// The list points into the community index and is valid until the next mutation.
+const int *query_community(int community, int *count) {
+    compute_communities();
+    if (community < 0 || community >= community_count) {
+        *count = 0;
+        return community_by_followers;
+    }
+    *count = community_end(community) - community_begin(community);
+    return community_by_followers + community_begin(community);
+}
+
+// Fills the triangle count, clustering coefficient and community of user
+// index 'user'. A removed user has no triangles and community -1 of size 0.
+void query_structure(int user, UserStructure *out) {
+    if (is_user_removed(user)) {
+        *out = (UserStructure){ 0, 0.0, -1, 0 };
+        return;
+    }
+    compute_triangles();
+    compute_communities();
+    out->triangles = triangle_count[user];
+    out->clustering = clustering[user];
+    out->community = community_id[user];
+    out->community_size = community_end(out->community) - community_begin(out->community);
+}
+
+// Writes the estimated number of users within 1..hops hops of user index
+// 'user' to 'counts'; hops is at most SKETCH_HOPS. See query_reach() for the
+// exact counts.
+void query_reach_estimate(int user, int hops, int *counts) {
+    compute_sketches();
+    for (int h = 1; h <= hops; h++) counts[h - 1] = (int)lrintf(reach_estimate[(size_t)user * SKETCH_HOPS + h - 1]);
+}
+
+// Writes up to k users whose connections are most like those of user index
+// 'user' to 'out', with their estimated Jaccard similarity. Returns the number
+// of users written.
+int query_similar(int user, int k, ScoredUser *out) {
+    compute_sketches();
+    return similar_users(user, k, out);
+}
+
+// Returns the users of a country, most followers first, and sets *count.
+// The list points into the country index and is valid until the next mutation.
+const int *query_country(const char *country, int *count) {
+    int code = find_country(country);
+    if (code < 0) {
+        *count = 0;
+        return country_by_followers;
+    }
+    *count = country_end(code) - country_begin(code);
+    return country_by_followers + country_begin(code);
+}
+
+static int influence_tree_visit(int user, int parent_user, int parent_node, int depth, bool last, int community,
+                                int max_depth, int width, TreeNode *nodes, int capacity, int count) {
+    int self = count;
+    if (count < capacity) nodes[count] = (TreeNode){ user, parent_node, depth, last };
+    count++;
+    if (depth == max_depth) return count;
+
+    int *candidates = xmalloc(sizeof(int) * (out_degree(user) + 1));
+    int *best = xmalloc(sizeof(int) * (width > 0 ? width : 1));
+    int candidate_count = 0;
+    NeighbourCursor cursor = out_neighbours(user);
+    for (int v; next_neighbour(&cursor, &v);) {
+        if (v != parent_user && (community < 0 || community_id[v] == community)) candidates[candidate_count++] = v;
+    }
+    int shown = select_top_n(candidates, candidate_count, width, compareIndicesByFollowers, best);
+    for (int i = 0; i < shown; i++) {
+        count = influence_tree_visit(best[i], user, self, depth + 1, i == shown - 1, community,
+                                     max_depth, width, nodes, capacity, count);
+    }
+    free(best);
+    free(candidates);
+    return count;
+}
+
+// Builds the tree of the most-followed connections below user index 'root':
+// each node lists its 'width' connections with the most followers (skipping
+// the node it was reached from), down to 'max_depth' levels below the root.
+// With 'community' >= 0 only connections in that community are followed.
+// Writes up to 'capacity' nodes in preorder and returns the total number of
+// nodes; a tree has at most 1 + width + ... + width^max_depth of them.
+int query_influence_tree(int root, int community, int max_depth, int width, TreeNode *nodes, int capacity) {
+    INSTRUMENT_SPAN(OP_INFLUENCE_TREE);
+    if (community >= 0) compute_communities();
+    return influence_tree_visit(root, -1, -1, 0, true, community, max_depth, width, nodes, capacity, 0);
+}
+
+// ---------------------------------------------------------------------------
+// Menu output
+//
+// Everything the interactive menu prints, built on the query API.
+// ---------------------------------------------------------------------------
+
+#define TREE_DEPTH 3
+#define TREE_WIDTH 3
+#define TREE_MAX_NODES (1 + TREE_WIDTH + TREE_WIDTH * TREE_WIDTH + TREE_WIDTH * TREE_WIDTH * TREE_WIDTH)
+
+QueryContext menu_context = { .parallel = true };
+
+// Performs Breadth-First Search starting from a given user and prints the
+// reached users level by level.
+void bfs(int start_index) {
+    int *order = xmalloc(sizeof(int) * user_count);
+    int count = query_bfs(&menu_context, start_index, order);
+    printf(COLOR_CYAN "\nBFS traversal starting from user ID %d: " COLOR_RESET, user_ids[start_index]);
+    for (int i = 0; i < count; i++) printf("%d -> ", user_ids[order[i]]);
+    printf("\n");
+    free(order);
+}
+
+// Prints how many users are reachable within 1..k hops of a given user.
+void show_reach(int start_index, int k) {
+    int *counts = xmalloc(sizeof(int) * k);
+    query_reach(&menu_context, start_index, k, counts);
+    printf(COLOR_CYAN "\nAudience of %s (ID: %d) by number of hops:\n" COLOR_RESET, user_name(start_index), user_ids[start_index]);
+    for (int hops = 1; hops <= k; hops++) {
+        printf("Within %d hop%s: %d users\n", hops, hops == 1 ? "" : "s", counts[hops - 1]);
+    }
+    free(counts);
+}
+
+// Prints the hop distance and one shortest path between two users.
+void show_shortest_path(int source, int target) {
+    int *path = xmalloc(sizeof(int) * user_count);
+    int hops = query_shortest_path(&menu_context, source, target, path);
+    printf(COLOR_GREEN "\nShortest path from %s (ID: %d) to %s (ID: %d):\n" COLOR_RESET,
+           user_name(source), user_ids[source], user_name(target), user_ids[target]);
+    if (hops < 0) {
+        printf("No path found: %s cannot reach %s through connections.\n", user_name(source), user_name(target));
+    } else {
+        printf("Degrees of separation: %d\n", hops);
+        for (int i = 0; i <= hops; i++) {
+            int v = path[i];
+            printf("%s%s (ID: %d)", i ? " -> " : "", user_name(v), user_ids[v]);
+        }
+        printf("\n");
+    }
+    free(path);
+}
+
+// Performs Depth-First Search starting from a given user.
+void dfs(int start_index) {
+    int *order = xmalloc(sizeof(int) * user_count);
+    int count = query_dfs(&menu_context, start_index, order);
+    printf(COLOR_YELLOW "\nDFS traversal starting from user ID %d: " COLOR_RESET, user_ids[start_index]);
+    for (int i = 0; i < count; i++) printf("%d -> ", user_ids[order[i]]);
+    printf("\n");
+    free(order);
+}
+
+// Prints whether one user can reach another through connections.
+void show_reachability(int from, int to) {
+    bool forward = query_reachable(&menu_context, from, to), backward = query_reachable(&menu_context, to, from);
+    printf(COLOR_GREEN "\nReachability between %s (ID: %d) and %s (ID: %d):\n" COLOR_RESET,
+           user_name(from), user_ids[from], user_name(to), user_ids[to]);
+    printf("%s %s reach %s.\n", user_name(from), forward ? "can" : "cannot", user_name(to));
+    printf("%s %s reach %s.\n", user_name(to), backward ? "can" : "cannot", user_name(from));
+    if (forward && backward) printf("They are in the same strongly connected component.\n");
+    else if (weak_component(from) != weak_component(to)) printf("They are in different parts of the network.\n");
+}
+
+// Prints how fragmented the network is and where a given user sits in it.
+void show_components_summary(int user_index) {
+    ComponentSummary summary;
+    query_components(user_index, &summary);
+    printf(COLOR_GREEN "\nNetwork connectivity summary:\n" COLOR_RESET);
+    printf("Strongly connected components: %d (largest has %d users)\n", summary.strong_components, summary.largest_strong);
+    printf("Weakly connected components: %d (largest has %d users)\n", summary.weak_components, summary.largest_weak);
+    printf("Isolated users: %d\n", summary.isolated);
+    printf("%s (ID: %d) is in a strongly connected component of %d users and a weakly connected component of %d users.\n",
+           user_name(user_index), user_ids[user_index], summary.user_strong_size, summary.user_weak_size);
+}
+
+// Computes all-pairs shortest paths and prints the distances between the first users.
+void floyd_warshall() {
+    if (!compute_all_pairs()) {
+        printf("All-pairs distances for %d users need %llu MB; limit is %llu MB.\n",
+               user_count, all_pairs_bytes() >> 20, APSP_MAX_BYTES >> 20);
+        return;
+    }
+    int n = apsp_n;
+    printf(COLOR_GREEN "\nShortest path distances between all users (IDs):\n" COLOR_RESET);
+    printf("    ");
+    for (int i = 0; i < n && i < 20; i++) printf("%-4d", user_ids[row_user(i)]);
+    printf("\n");
+    for (int i = 0; i < n && i < 20; i++) {
+        printf("%-4d", user_ids[row_user(i)]);
+        for (int j = 0; j < n && j < 20; j++) {
+            int d = apsp_distance(row_user(i), row_user(j));
+            if (d < 0) printf("INF ");
+            else printf("%-4d", d);
+        }
+        printf("\n");
+    }
+    printf("(Displaying first 20 users for brevity)\n");
+}
+
+// Shows the mutual connections between two users.
+void show_mutuals(const char *name1, const char *name2) {
+    int idx1 = find_user_by_name(name1);
+    int idx2 = find_user_by_name(name2);
+    if (idx1 == -1 || idx2 == -1) {
+        printf("One or both users not found.\n");
+        return;
+    }
+
+    PairSimilarity pair;
+    int *mutuals = xmalloc(sizeof(int) * (out_degree(idx1) + 1));
+    query_mutuals(&menu_context, idx1, idx2, &pair, mutuals);
+
+    printf(COLOR_CYAN "\nMutual connections between %s and %s (User IDs):\n" COLOR_RESET, name1, name2);
+    for (int i = 0; i < pair.mutual_count; i++) {
+        int mutual_idx = mutuals[i];
+        printf("- %d (%s, %d followers, %s)\n",
+               user_ids[mutual_idx],
+               user_name(mutual_idx),
+               user_followers[mutual_idx],
+               user_country(mutual_idx));
+    }
+    if (pair.mutual_count == 0) {
+        printf("No mutual connections found.\n");
+    } else {
+        printf("%d mutual connections (Jaccard %.3f, Adamic-Adar %.3f)\n",
+               pair.mutual_count, pair.jaccard, pair.adamic_adar);
+    }
+    free(mutuals);
+}
+
+// Function to print a simple text-based tree of the most-followed connections below a user index,
+// optionally only through users of one community (-1 for any)
+void printTextTree(int root, int community) {
+    TreeNode nodes[TREE_MAX_NODES];
+    int count = query_influence_tree(root, community, TREE_DEPTH, TREE_WIDTH, nodes, TREE_MAX_NODES);
+    for (int k = 0; k < count; k++) {
+        int u = nodes[k].user, depth = nodes[k].depth;
+        for (int i = 0; i < depth; i++) {
+            printf("%s", (i == depth - 1) ? (nodes[k].last ? "└── " : "├── ") : "│   ");
+        }
+        printf("%s (ID: %d, F:%d, A:%.2f, C:%s)\n", user_name(u), user_ids[u], user_followers[u], user_activity[u], user_country(u));
+    }
+}
+
+// Shows the top N influencers based on a specified criteria (followers, activity or pagerank).
+void show_top_n_influencers_by(int n, const char *criteria) {
+    if (n <= 0 || n > live_user_count()) {
+        printf("Invalid number of influencers.\n");
+        return;
+    }
+
+    TopNQuery query = { RANK_BY_FOLLOWERS, -1, INT_MIN, -1 };
+    if (strcmp(criteria, "followers") == 0) {
+        printf(COLOR_YELLOW "\nTop %d Influencers by Followers:\n" COLOR_RESET, n);
+    } else if (strcmp(criteria, "activity") == 0) {
+        query.key = RANK_BY_ACTIVITY;
+        printf(COLOR_YELLOW "\nTop %d Influencers by Activity Score:\n" COLOR_RESET, n);
+    } else if (strcmp(criteria, "pagerank") == 0) {
+        query.key = RANK_BY_PAGERANK;
+        printf(COLOR_YELLOW "\nTop %d Influencers by PageRank:\n" COLOR_RESET, n);
+    } else {
+        printf("Invalid sorting criteria.\n");
+        return;
+    }
+
+    int *order = xmalloc(sizeof(int) * n);
+    n = top_n_influencers(&query, n, order);
+    for (int i = 0; i < n; i++) {
+        int u = order[i];
+        printf("%d. %s (ID: %d) - F:%d, A:%.2f, C:%s",
+               i + 1, user_name(u), user_ids[u], user_followers[u], user_activity[u], user_country(u));
+        if (query.key == RANK_BY_PAGERANK) printf(", PR:%.6f", pagerank[u]);
+        printf("\n");
+    }
+    free(order);
+}
+
+// Shows the PageRank of a user and the users its personalized PageRank
+// ranks highest, i.e. where a random walk from it that keeps restarting at
+// it spends the most time.
+void show_personalized_pagerank(int user_index) {
+    compute_pagerank();
+    printf(COLOR_YELLOW "\nPageRank of %s (ID: %d): %.6f (rank %d of %d, %d iterations)\n" COLOR_RESET,
+           user_name(user_index), user_ids[user_index], pagerank[user_index],
+           pagerank_rank(user_index), live_user_count(), pagerank_iterations);
+
+    ScoredUser top[RECOMMENDATION_COUNT];
+    int count = query_personalized_pagerank(&menu_context, user_index, RECOMMENDATION_COUNT, top);
+    printf("Users closest to %s by personalized PageRank:\n", user_name(user_index));
+    for (int i = 0; i < count; i++) {
+        int u = top[i].user;
+        printf("- %s (ID: %d) - score %.4f, F:%d, C:%s\n",
+               user_name(u), user_ids[u], top[i].score, user_followers[u], user_country(u));
+    }
+    if (count == 0) {
+        printf("No users are reachable from this user.\n");
+    }
+}
+
+// Searches for and displays influencers from a specific country.
+// With 'community' >= 0 only users of that community are listed.
+void search_by_country(const char *country, int community) {
+    if (community >= 0) {
+        compute_communities();
+        printf(COLOR_GREEN "\nInfluencers from %s in community %d:\n" COLOR_RESET, country, community);
+    } else {
+        printf(COLOR_GREEN "\nInfluencers from %s:\n" COLOR_RESET, country);
+    }
+    int count, shown = 0;
+    const int *users = query_country(country, &count);
+    for (int k = 0; k < count; k++) {
+        int i = users[k];
+        if (community >= 0 && community_id[i] != community) continue;
+        printf("- %s (ID: %d) - F:%d, A:%.2f\n",
+               user_name(i), user_ids[i], user_followers[i], user_activity[i]);
+        shown++;
+    }
+    if (shown == 0) {
+        printf("No influencers found from this country.\n");
+    }
+}
+
+// Asks for an optional community ID. Returns -1 if the answer is blank or
+// not a number.
+int prompt_community() {
+    char text[32], *end;
+    printf("Enter community ID (blank for any): ");
+    if (!fgets(text, sizeof(text), stdin)) return -1;
+    trim_newline(text);
+    long community = strtol(text, &end, 10);
+    return end != text && *end == '\0' && community >= 0 && community <= INT_MAX ? (int)community : -1;
+}
+
+// Shows the triangles, clustering coefficient and community of a user, the
+// same figures for the whole network, and the community's top members.
+void show_structure(int user_index) {
+    UserStructure structure;
+    query_structure(user_index, &structure);
+    printf(COLOR_YELLOW "\nNetwork structure around %s (ID: %d):\n" COLOR_RESET, user_name(user_index), user_ids[user_index]);
+    printf("Triangles through this user: %lld\n", structure.triangles);
+    printf("Clustering coefficient: %.4f (network average %.4f, transitivity %.4f)\n",
+           structure.clustering, average_clustering, transitivity);
+    printf("Community %d: %d users (%d communities in the network)\n", structure.community, structure.community_size, community_count);
+    printf("Triangles in the network: %lld\n", total_triangles);
+
+    int count;
+    const int *members = query_community(structure.community, &count);
+    printf("Most followed members of the community:\n");
+    for (int k = 0; k < count && k < 3; k++) {
+        int u = members[k];
+        printf("- %s (ID: %d) - F:%d, C:%s\n", user_name(u), user_ids[u], user_followers[u], user_country(u));
+    }
+}
+
+// Shows the estimated audience of a user within 1..SKETCH_HOPS hops and the
+// users with the most similar connections, both read from the sketches.
+void show_sketches(int user_index) {
+    int counts[SKETCH_HOPS];
+    query_reach_estimate(user_index, SKETCH_HOPS, counts);
+    printf(COLOR_CYAN "\nEstimated audience of %s (ID: %d) by number of hops:\n" COLOR_RESET, user_name(user_index), user_ids[user_index]);
+    for (int hops = 1; hops <= SKETCH_HOPS; hops++) {
+        printf("Within %d hop%s: about %d users\n", hops, hops == 1 ? "" : "s", counts[hops - 1]);
+    }
+
+    ScoredUser similar[RECOMMENDATION_COUNT];
+    int count = query_similar(user_index, RECOMMENDATION_COUNT, similar);
+    printf("Users with the most similar connections:\n");
+    for (int i = 0; i < count; i++) {
+        int u = similar[i].user;
+        printf("- %s (ID: %d) - about %.0f%% alike, %d connections\n",
+               user_name(u), user_ids[u], 100.0 * similar[i].score, out_degree(u));
+    }
+    if (count == 0) {
+        printf("No users with similar connections found.\n");
+    }
+}
+
+// Function to get friend recommendations based on mutual friends
+void recommend_friends(const char *name) {
+    int user_index = find_user_by_name(name);
+    if (user_index == -1) {
+        printf("User not found.\n");
+        return;
+    }
+
+    Recommendation recommendations[RECOMMENDATION_COUNT];
+    int recommendation_count = query_recommend(&menu_context, user_index, RECOMMENDATION_COUNT, NULL, recommendations);
+
+    printf(COLOR_YELLOW "\nFriend recommendations for %s (ID: %d) based on mutual friends:\n" COLOR_RESET, user_name(user_index), user_ids[user_index]);
+    if (recommendation_count > 0) {
+        for (int i = 0; i < recommendation_count; i++) {
+            int recommended_index = recommendations[i].user;
+            printf("- %s (ID: %d) - %d mutual friends\n",
+                   user_name(recommended_index), user_ids[recommended_index], recommendations[i].mutuals);
+        }
+    } else {
+        printf("No friend recommendations found based on mutual connections.\n");
+    }
+}
+
+// Displays a menu for graph algorithms related to a specific user.
+void graph_algorithms_menu(int start_index) {
+    int choice;
+    while (1) {
+        printf(COLOR_CYAN "\nGraph Algorithms for User ID %d (%s):\n" COLOR_RESET, user_ids[start_index], user_name(start_index));
+        printf("1. Depth-First Search (DFS) Traversal (by User ID)\n");
+        printf("2. Breadth-First Search (BFS) Traversal (by User ID)\n");
+        printf("3. All-PairsShortest Path (Floyd-Warshall) (by User ID)\n");
+        printf("4. Shortest path to another user (by name or User ID)\n");
+        printf("5. Audience reachable within k hops\n");
+        printf("6. Check whether this user can reach another user (by name or User ID)\n");
+        printf("7. Network connectivity summary\n");
+        printf("8. PageRank and personalized PageRank\n");
+        printf("9. Triangles, clustering coefficient and community\n");
+        printf("10. Estimated audience and users with similar connections\n");
+        printf("11. Return to main menu\n");
+        printf("Choose option: ");
+        scanf("%d", &choice);
+        getchar(); // Consume newline
+
+        if (choice == 11) break;
+
+        switch (choice) {
+            case 1:
+                dfs(start_index);
+                break;
+            case 2:
+                bfs(start_index);
+                break;
+            case 3:
+                floyd_warshall();
+                break;
+            case 4: {
+                char target_text[MAX_NAME];
+                printf("Enter target user name or ID: ");
+                fgets(target_text, sizeof(target_text), stdin);
+                trim_newline(target_text);
+                int target_index = resolve_user(target_text);
+                if (target_index != -1) {
+                    show_shortest_path(start_index, target_index);
+                } else {
+                    printf("User not found.\n");
+                }
+                break;
+            }
+            case 5: {
+                int k;
+                printf("Enter maximum number of hops: ");
+                scanf("%d", &k);
+                getchar();
+                if (k > 0) {
+                    show_reach(start_index, k);
+                } else {
+                    printf("Number of hops must be positive.\n");
+                }
+                break;
+            }
+            case 6: {
+                char target_text[MAX_NAME];
+                printf("Enter target user name or ID: ");
+                fgets(target_text, sizeof(target_text), stdin);
+                trim_newline(target_text);
+                int target_index = resolve_user(target_text);
+                if (target_index != -1) {
+                    show_reachability(start_index, target_index);
+                } else {
+                    printf("User not found.\n");
+                }
+                break;
+            }
+            case 7:
+                show_components_summary(start_index);
+                break;
+            case 8:
+                show_personalized_pagerank(start_index);
+                break;
+            case 9:
+                show_structure(start_index);
+                break;
+            case 10:
+                show_sketches(start_index);
+                break;
+            default:
+                printf("Invalid choice. Please try again.\n");
+                break;
+        }
+    }
+}
+
+// Displays the main menu of the social network analysis tool.
+void display_menu() {
+    printf(COLOR_BOLD COLOR_CYAN "\n===== SOCIAL MEDIA NETWORK ANALYSIS =====\n" COLOR_RESET);
+    printf("1. Show user connections count\n");
+    printf("2. Show user activity score\n");
+    printf("3. Find mutual connections between two users (by User ID)\n");
+    printf("4. Show influencers with minimum followers\n");
+    printf("5. Show top N influencers\n");
+    printf("6. Search influencers by country\n");
+    printf("7. Graph algorithms (DFS/BFS/Shortest Path by User ID)\n");
+    printf("8. Friend recommendations based on mutual friends\n");
+    printf("9. Visualize network as tree\n");
+    printf("10. Exit\n");
+    printf(COLOR_BOLD "Enter your choice: " COLOR_RESET);
+}
+
+// Handles the visualization of the network as a text-based tree based on user choice.
+void visualize_network_tree() {
+    int choice;
+    printf("\nVisualize Network Tree Based On:\n");
+    printf("1. Country (Top 3 Influencers)\n");
+    printf("2. Mutual Connections (Starting from a user, max depth/width 3)\n");
+    printf("Enter your choice: ");
+    scanf("%d", &choice);
+    getchar(); // Consume newline
+
+    if (choice == 1) {
+        char country[MAX_COUNTRY];
+        printf("Enter country to visualize top 3 influencers: ");
+        fgets(country, sizeof(country), stdin);
+        trim_newline(country);
+        int community = prompt_community();
+        // Find top 3 influencers from the given country (and community)
+        int users[3], count = 0, code = find_country(country);
+        if (code >= 0) {
+            TopNQuery query = { RANK_BY_FOLLOWERS, code, INT_MIN, community };
+            count = top_n_influencers(&query, 3, users);
+        }
+        printf(COLOR_YELLOW "\nTree visualization of top 3 influencers from %s:\n" COLOR_RESET, country);
+        for (int i = 0; i < count; i++) {
+            int u = users[i];
+            printf("└── %s (ID: %d, F:%d, A:%.2f)\n", user_name(u), user_ids[u], user_followers[u], user_activity[u]);
+        }
+    } else if (choice == 2) {
+        char start_name[MAX_NAME];
+        printf("Enter user name to start mutual connection tree: ");
+        fgets(start_name, sizeof(start_name), stdin);
+        trim_newline(start_name);
+        int start_index = find_user_by_name(start_name);
+        if (start_index != -1) {
+            int community = prompt_community();
+            printf(COLOR_CYAN "\nTree visualization of mutual connections (max depth/width 3):\n" COLOR_RESET);
+            printTextTree(start_index, community);
+        } else {
+            printf("User not found.\n");
+        }
+    } else {
+        printf("Invalid choice for tree visualization.\n");
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Instrumentation report
+//
+// With -DINSTRUMENT, --stats text|json prints span latencies, counters and
+// the memory held by each structure to stderr on exit, and SIGUSR1 requests
+// the same report at the next safe point (between menu choices or batch
+// groups) without stopping the process.
+// ---------------------------------------------------------------------------
+
+#ifdef INSTRUMENT
+
+typedef struct {
+    const char *name;
+    size_t bytes;
+} MemoryItem;
+
+// Returns the bytes held by the buffers of a query context.
+static size_t query_context_bytes(const QueryContext *ctx) {
+    return (size_t)ctx->bfs.capacity * 2 * sizeof(int) + 3 * (size_t)bitmap_words(ctx->bfs.capacity) * sizeof(uint64_t) +
+           (size_t)ctx->path.capacity * (sizeof(uint32_t) + 4 * sizeof(int)) +
+           (size_t)ctx->recommend.capacity * 2 * sizeof(int) +
+           (ctx->push.capacity ? (size_t)ctx->push.capacity * (2 * sizeof(double) + sizeof(bool) + 2 * sizeof(int)) + sizeof(int) : 0) +
+           ((size_t)ctx->levels_capacity + ctx->scratch_capacity) * sizeof(int);
+}
+
+// Returns 'bytes' unless 'ptr' points into the mapped snapshot, whose pages
+// are counted once, under mapped_snapshot.
+static size_t heap_bytes(const void *ptr, size_t bytes) {
+    return in_snapshot(ptr) ? 0 : bytes;
+}
+
+// Fills 'items' with the bytes held by each structure and returns how many.
+// Structures backed by the mapped CSV file count their mapped size; arrays
+// still inside a mapped snapshot count nothing of their own.
+static int memory_usage(MemoryItem *items) {
+    size_t n = (size_t)user_capacity, count = 0;
+    size_t forward_slots = graph_mutable ? (size_t)forward_lists.capacity : (size_t)edge_capacity;
+    size_t reverse_slots = graph_mutable ? (size_t)reverse_lists.capacity : (size_t)edge_capacity;
+    size_t list_bounds = adj_ends ? 2 * n * sizeof(int) : 0;
+    size_t hub_bytes = 0;
+    if (hub_bits) {
+        hub_bytes = (size_t)hub_bits_users * sizeof(uint64_t *);
+        for (int v = 0; v < hub_bits_users; v++)
+            if (hub_bits[v]) hub_bytes += (size_t)bitmap_words(hub_bits_users) * sizeof(uint64_t);
+    }
+
+    items[count++] = (MemoryItem){ "user_columns", heap_bytes(user_ids, n * sizeof(int)) + heap_bytes(user_followers, n * sizeof(int)) +
+                                                   heap_bytes(user_activity, n * sizeof(float)) +
+                                                   heap_bytes(user_country_ids, n * sizeof(uint16_t)) +
+                                                   heap_bytes(user_name_offsets, n * sizeof(size_t)) +
+                                                   (user_removed ? n * sizeof(bool) : 0) };
+    items[count++] = (MemoryItem){ "row_maps", user_rows ? heap_bytes(user_rows, n * sizeof(int)) + heap_bytes(row_users, n * sizeof(int)) : 0 };
+    items[count++] = (MemoryItem){ "strings", heap_bytes(string_pool, string_pool_capacity ? string_pool_capacity : string_pool_size) };
+    items[count++] = (MemoryItem){ "countries", heap_bytes(countries.offsets, (size_t)countries.capacity * sizeof(size_t)) +
+                                                (countries.slots ? heap_bytes(countries.slots, ((size_t)countries.mask + 1) * sizeof(NameSlot)) : 0) };
+    size_t packed_index = graph_compressed ? (n + 1 + (size_t)edge_count / ADJ_BLOCK + 1) * sizeof(size_t) : 0;
+    size_t forward_targets = graph_compressed ? packed_adj.size + packed_index : heap_bytes(adj_targets, forward_slots * sizeof(int));
+    size_t reverse_targets = graph_compressed ? packed_rev.size + packed_index : heap_bytes(rev_targets, reverse_slots * sizeof(int));
+    items[count++] = (MemoryItem){ "adjacency", heap_bytes(adj_offsets, (n + 1) * sizeof(int)) + forward_targets + list_bounds };
+    items[count++] = (MemoryItem){ "reverse_adjacency", heap_bytes(rev_offsets, (n + 1) * sizeof(int)) + reverse_targets + list_bounds };
+    items[count++] = (MemoryItem){ "id_index", id_index ? heap_bytes(id_index, ((size_t)id_index_mask + 1) * sizeof(IdSlot)) : 0 };
+    items[count++] = (MemoryItem){ "name_index", (name_index ? heap_bytes(name_index, ((size_t)name_index_mask + 1) * sizeof(NameSlot)) : 0) +
+                                                 (name_next ? heap_bytes(name_next, n * sizeof(int)) : 0) };
+    items[count++] = (MemoryItem){ "rankings", follower_order ? heap_bytes(follower_order, n * sizeof(int)) +
+                                                                heap_bytes(activity_order, n * sizeof(int)) : 0 };
+    items[count++] = (MemoryItem){ "country_postings", country_postings ? heap_bytes(country_postings, ((size_t)countries.count + 1) * sizeof(int)) +
+                                                                          heap_bytes(country_by_followers, n * sizeof(int)) +
+                                                                          heap_bytes(country_by_activity, n * sizeof(int)) : 0 };
+    items[count++] = (MemoryItem){ "components", (scc_id ? (n + (size_t)scc_count) * sizeof(int) : 0) +
+                                                 (wcc_id ? (n + 2 * (size_t)wcc_labels) * sizeof(int) : 0) };
+    items[count++] = (MemoryItem){ "hub_bitmaps", hub_bytes };
+    items[count++] = (MemoryItem){ "pagerank", pagerank ? (size_t)pagerank_users * (sizeof(float) + 2 * sizeof(int)) : 0 };
+    items[count++] = (MemoryItem){ "communities", community_id ? (2 * n + community_count + 1) * sizeof(int) : 0 };
+    items[count++] = (MemoryItem){ "triangles", triangle_count ? n * (sizeof(long long) + sizeof(float)) : 0 };
+    items[count++] = (MemoryItem){ "sketches", minhash ? (size_t)sketch_users * (SKETCH_HOPS * sizeof(float) + MINHASH_SIZE * sizeof(uint32_t) +
+                                                                 3 * LSH_BANDS * sizeof(int)) : 0 };
+    items[count++] = (MemoryItem){ "all_pairs", apsp_dist ? (size_t)apsp_stride * apsp_stride * sizeof(dist_t) : 0 };
+    items[count++] = (MemoryItem){ "menu_query_context", query_context_bytes(&menu_context) };
+    items[count++] = (MemoryItem){ "mapped_snapshot", snapshot_size };
+    return (int)count;
+}
+
+// Writes the spans that ran, the counters and the memory per structure to 'out'.
+void print_instrumentation(FILE *out, bool json) {
+    uint64_t counters[COUNTER_COUNT] = { 0 };
+    for (int t = 0; t < INSTRUMENT_MAX_THREADS; t++)
+        for (int c = 0; c < COUNTER_COUNT; c++) counters[c] += counter_slots[t].values[c];
+    MemoryItem memory[24];
+    int memory_count = memory_usage(memory);
+    size_t memory_total = 0;
+    for (int i = 0; i < memory_count; i++) memory_total += memory[i].bytes;
+
+    if (json) {
+        fprintf(out, "{\"spans\": {");
+        bool first = true;
+        for (int op = 0; op < OP_COUNT; op++) {
+            const LatencyHistogram *h = &op_histograms[op];
+            if (h->count == 0) continue;
+            fprintf(out, "%s\"%s\": {\"count\": %llu, \"total_ms\": %.3f, \"p50_us\": %.3f, \"p90_us\": %.3f, \"p99_us\": %.3f, \"max_us\": %.3f}",
+                    first ? "" : ", ", instrument_op_names[op], (unsigned long long)h->count, h->total_ns / 1e6,
+                    histogram_percentile(h, 0.50) / 1e3, histogram_percentile(h, 0.90) / 1e3,
+                    histogram_percentile(h, 0.99) / 1e3, h->max_ns / 1e3);
+            first = false;
+        }
+        fprintf(out, "}, \"counters\": {");
+        for (int c = 0; c < COUNTER_COUNT; c++)
+            fprintf(out, "%s\"%s\": %llu", c ? ", " : "", instrument_counter_names[c], (unsigned long long)counters[c]);
+        fprintf(out, "}, \"memory_bytes\": {");
+        for (int i = 0; i < memory_count; i++)
+            fprintf(out, "%s\"%s\": %zu", i ? ", " : "", memory[i].name, memory[i].bytes);
+        fprintf(out, ", \"total\": %zu}}\n", memory_total);
+    } else {
+        fprintf(out, "%-24s %10s %12s %10s %10s %10s %10s\n", "Operation", "Count", "Total ms", "p50 us", "p90 us", "p99 us", "Max us");
+        for (int op = 0; op < OP_COUNT; op++) {
+            const LatencyHistogram *h = &op_histograms[op];
+            if (h->count == 0) continue;
+            fprintf(out, "%-24s %10llu %12.3f %10.3f %10.3f %10.3f %10.3f\n", instrument_op_names[op],
+                    (unsigned long long)h->count, h->total_ns / 1e6,
+                    histogram_percentile(h, 0.50) / 1e3, histogram_percentile(h, 0.90) / 1e3,
+                    histogram_percentile(h, 0.99) / 1e3, h->max_ns / 1e3);
+        }
+        fprintf(out, "\n%-24s %20s\n", "Counter", "Value");
+        for (int c = 0; c < COUNTER_COUNT; c++)
+            fprintf(out, "%-24s %20llu\n", instrument_counter_names[c], (unsigned long long)counters[c]);
+        fprintf(out, "\n%-24s %20s\n", "Structure", "Bytes");
+        for (int i = 0; i < memory_count; i++) fprintf(out, "%-24s %20zu\n", memory[i].name, memory[i].bytes);
+        fprintf(out, "%-24s %20zu\n", "total", memory_total);
+    }
+    fflush(out);
+}
+
+volatile sig_atomic_t instrumentation_requested = 0;
+bool instrumentation_json = false;
+
+static void request_instrumentation(int signal_number) {
+    (void)signal_number;
+    instrumentation_requested = 1;
+}
+
+// Makes SIGUSR1 request a report in the given format.
+void install_instrumentation_signal(bool json) {
+    instrumentation_json = json;
+#ifdef SIGUSR1
+    signal(SIGUSR1, request_instrumentation);
+#endif
+}
+
+// Prints a report to stderr if one was requested since the last call.
+void poll_instrumentation() {
+    if (!instrumentation_requested) return;
+    instrumentation_requested = 0;
+    print_instrumentation(stderr, instrumentation_json);
+}
+
+static void print_instrumentation_at_exit() {
+    print_instrumentation(stderr, instrumentation_json);
+}
+
+#define POLL_INSTRUMENTATION() poll_instrumentation()
+
+#else
+
+#define POLL_INSTRUMENTATION() ((void)0)
+
+#endif
+
+// ---------------------------------------------------------------------------
+// Batch queries
+//
+// --batch reads one query per line from a file or stdin and writes one result
+// line per query, in input order, as TSV or JSON Lines. Fields are separated
+// by tabs and users are given by ID or name. Queries run in groups: all user
+// arguments of a group are resolved in bulk, then the queries run in parallel
+// with one QueryContext per thread, each formatting into its own buffer.
+// A write (follow / unfollow) ends its group and is applied on its own, so
+// reads before it never see it and reads after it always do.
+// ---------------------------------------------------------------------------
+
+#define BATCH_GROUP_SIZE 4096
+#define BATCH_MAX_LINE 4096
+#define BATCH_MAX_FIELDS 6
+#define BATCH_MAX_HOPS 16
+
+typedef enum {
+    BATCH_CONNECTIONS,
+    BATCH_ACTIVITY,
+    BATCH_MUTUALS,
+    BATCH_TOP,
+    BATCH_COUNTRY,
+    BATCH_ABOVE,
+    BATCH_REACH,
+    BATCH_PATH,
+    BATCH_REACHABLE,
+    BATCH_RECOMMEND,
+    BATCH_PAGERANK,
+    BATCH_STRUCTURE,
+    BATCH_COMMUNITY,
+    BATCH_REACH_ESTIMATE,
+    BATCH_SIMILAR,
+    BATCH_FOLLOW,
+    BATCH_UNFOLLOW
+} BatchCommand;
+
+// Command names, argument counts and how many leading arguments are users.
+static const struct {
+    const char *name;
+    int min_args, max_args, user_args;
+    bool write;
+} batch_commands[] = {
+    [BATCH_CONNECTIONS] = { "connections", 1, 1, 1, false }, // user
+    [BATCH_ACTIVITY]    = { "activity", 1, 1, 1, false },    // user
+    [BATCH_MUTUALS]     = { "mutuals", 2, 2, 2, false },     // user, user
+    [BATCH_TOP]         = { "top", 1, 5, 0, false },         // n [followers|activity|pagerank [country|* [min_followers|* [community]]]]
+    [BATCH_COUNTRY]     = { "country", 1, 3, 0, false },     // country [limit [community]]
+    [BATCH_ABOVE]       = { "above", 1, 2, 0, false },       // threshold [limit]
+    [BATCH_REACH]       = { "reach", 2, 2, 1, false },       // user, hops
+    [BATCH_PATH]        = { "path", 2, 2, 2, false },        // user, user
+    [BATCH_REACHABLE]   = { "reachable", 2, 2, 2, false },   // user, user
+    [BATCH_RECOMMEND]   = { "recommend", 1, 2, 1, false },   // user [k]
+    [BATCH_PAGERANK]    = { "pagerank", 1, 2, 1, false },    // user [k]
+    [BATCH_STRUCTURE]   = { "structure", 1, 1, 1, false },   // user
+    [BATCH_COMMUNITY]   = { "community", 1, 2, 0, false },   // community [limit]
+    [BATCH_REACH_ESTIMATE] = { "reach_estimate", 2, 2, 1, false }, // user, hops
+    [BATCH_SIMILAR]     = { "similar", 1, 2, 1, false },     // user [k]
+    [BATCH_FOLLOW]      = { "follow", 2, 2, 2, true },       // user, user
+    [BATCH_UNFOLLOW]    = { "unfollow", 2, 2, 2, true },     // user, user
+};
+#define BATCH_COMMAND_COUNT ((int)(sizeof(batch_commands) / sizeof(batch_commands[0])))
+
+// Growable output text.
+typedef struct {
+    char *data;
+    size_t size, capacity;
+} TextBuffer;
+
+static void text_append(TextBuffer *text, const char *str, size_t length) {
+    if (text->size + length > text->capacity) {
+        while (text->size + length > text->capacity)
+            text->capacity = text->capacity ? text->capacity * 2 : 256;
+        text->data = xrealloc(text->data, text->capacity);
+    }
+    memcpy(text->data + text->size, str, length);
+    text->size += length;
+}
+
+static void text_printf(TextBuffer *text, const char *format, ...) {
+    char small[64];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(small, sizeof(small), format, args);
+    va_end(args);
+    if (length < (int)sizeof(small)) {
+        text_append(text, small, (size_t)length);
+        return;
+    }
+    char *large = xmalloc((size_t)length + 1);
+    va_start(args, format);
+    vsnprintf(large, (size_t)length + 1, format, args);
+    va_end(args);
+    text_append(text, large, (size_t)length);
+    free(large);
+}
+
+// One parsed query line and its formatted result.
+typedef struct {
+    long long line;
+    int command;              // BatchCommand, or -1 if the line is invalid
+    char *text;               // copy of the line; fields point into it
+    char *fields[BATCH_MAX_FIELDS];
+    int arg_count;            // fields after the command name
+    int users[2];             // resolved user arguments, -1 if not found
+    const char *error;
+    TextBuffer out;
+} BatchQuery;
+
+// Output helpers: the same calls produce either a TSV row or a JSON object.
+static bool batch_json = false;
+
+static void out_begin(BatchQuery *q) {
+    q->out.size = 0;
+    if (batch_json) text_printf(&q->out, "{\"line\":%lld,\"command\":\"%s\"", q->line, batch_commands[q->command].name);
+    else text_printf(&q->out, "%lld\t%s", q->line, batch_commands[q->command].name);
+}
+
+static void out_end(BatchQuery *q) {
+    text_append(&q->out, batch_json ? "}\n" : "\n", batch_json ? 2 : 1);
+}
+
+static void out_key(BatchQuery *q, const char *key) {
+    if (batch_json) text_printf(&q->out, ",\"%s\":", key);
+    else text_append(&q->out, "\t", 1);
+}
+
+static void out_int(BatchQuery *q, const char *key, long long value) {
+    out_key(q, key);
+    text_printf(&q->out, "%lld", value);
+}
+
+static void out_double(BatchQuery *q, const char *key, double value) {
+    out_key(q, key);
+    text_printf(&q->out, "%.6g", value);
+}
+
+static void out_bool(BatchQuery *q, const char *key, bool value) {
+    out_key(q, key);
+    if (batch_json) text_printf(&q->out, "%s", value ? "true" : "false");
+    else text_append(&q->out, value ? "1" : "0", 1);
+}
+
+// Writes a string, JSON-escaped or with tabs and newlines blanked for TSV.
+static void out_string(BatchQuery *q, const char *key, const char *value) {
+    out_key(q, key);
+    if (batch_json) text_append(&q->out, "\"", 1);
+    for (const unsigned char *p = (const unsigned char *)value; *p; p++) {
+        if (batch_json && (*p == '"' || *p == '\\')) {
+            char escaped[2] = { '\\', (char)*p };
+            text_append(&q->out, escaped, 2);
+        } else if (*p < 0x20) {
+            if (batch_json) text_printf(&q->out, "\\u%04x", *p);
+            else text_append(&q->out, " ", 1);
+        } else {
+            text_append(&q->out, (const char *)p, 1);
+        }
+    }
+    if (batch_json) text_append(&q->out, "\"", 1);
+}
+
+// Writes a list of user IDs (given as indices) or plain integers.
+static void out_list(BatchQuery *q, const char *key, const int *values, int count, bool as_user_ids) {
+    out_key(q, key);
+    if (batch_json) text_append(&q->out, "[", 1);
+    for (int i = 0; i < count; i++) {
+        if (i) text_append(&q->out, ",", 1);
+        text_printf(&q->out, "%d", as_user_ids ? user_ids[values[i]] : values[i]);
+    }
+    if (batch_json) text_append(&q->out, "]", 1);
+}
+
+static void out_error(BatchQuery *q, const char *message, const char *detail) {
+    q->out.size = 0;
+    if (batch_json) {
+        text_printf(&q->out, "{\"line\":%lld", q->line);
+        if (q->command >= 0) text_printf(&q->out, ",\"command\":\"%s\"", batch_commands[q->command].name);
+        text_printf(&q->out, ",\"error\":\"%s", message);
+        if (detail) {
+            text_append(&q->out, ": ", 2);
+            for (const unsigned char *p = (const unsigned char *)detail; *p; p++) {
+                if (*p == '"' || *p == '\\') text_append(&q->out, "\\", 1);
+                if (*p < 0x20) text_printf(&q->out, "\\u%04x", *p);
+                else text_append(&q->out, (const char *)p, 1);
+            }
+        }
+        text_append(&q->out, "\"}\n", 3);
+    } else {
+        text_printf(&q->out, "%lld\terror\t%s", q->line, message);
+        if (detail) text_printf(&q->out, ": %s", detail);
+        text_append(&q->out, "\n", 1);
+    }
+}
+
+// Parses a whole decimal integer field.
+static bool parse_batch_int(const char *text, long long min, long long max, long long *out) {
+    char *end;
+    long long value = strtoll(text, &end, 10);
+    if (*text == '\0' || *end != '\0' || value < min || value > max) return false;
+    *out = value;
+    return true;
+}
+
+// Splits a line into a query. The line is copied; trailing CR/LF is dropped.
+static void parse_batch_line(BatchQuery *q, const char *line, long long line_number) {
+    memset(q->fields, 0, sizeof(q->fields));
+    q->line = line_number;
+    q->command = -1;
+    q->error = NULL;
+    q->users[0] = q->users[1] = -1;
+    q->text = xmalloc(strlen(line) + 1);
+    strcpy(q->text, line);
+    q->text[strcspn(q->text, "\r\n")] = '\0';
+
+    int count = 0;
+    char *p = q->text;
+    while (count < BATCH_MAX_FIELDS) {
+        q->fields[count++] = p;
+        char *tab = strchr(p, '\t');
+        if (!tab) break;
+        *tab = '\0';
+        p = tab + 1;
+        if (count == BATCH_MAX_FIELDS) {
+            q->error = "too many fields";
+            return;
+        }
+    }
+    for (int c = 0; c < BATCH_COMMAND_COUNT; c++) {
+        if (strcasecmp(q->fields[0], batch_commands[c].name) == 0) q->command = c;
+    }
+    if (q->command < 0) {
+        q->error = "unknown command";
+        return;
+    }
+    q->arg_count = count - 1;
+    if (q->arg_count < batch_commands[q->command].min_args || q->arg_count > batch_commands[q->command].max_args)
+        q->error = "wrong number of fields";
+}
+
+// Runs one read query (or an already-validated write) into q->out.
+static void run_batch_query(BatchQuery *q, QueryContext *ctx) {
+    char **args = q->fields + 1;
+    long long a = 0, b = 0;
+
+    if (q->error) {
+        out_error(q, q->error, q->command < 0 ? q->fields[0] : NULL);
+        return;
+    }
+    for (int i = 0; i < batch_commands[q->command].user_args; i++) {
+        if (q->users[i] < 0) {
+            out_error(q, "user not found", args[i]);
+            return;
+        }
+    }
+
+    int u = q->users[0], v = q->users[1];
+    switch (q->command) {
+        case BATCH_CONNECTIONS:
+            out_begin(q);
+            out_int(q, "id", user_ids[u]);
+            out_string(q, "name", user_name(u));
+            out_int(q, "connections", out_degree(u));
+            break;
+
+        case BATCH_ACTIVITY:
+            out_begin(q);
+            out_int(q, "id", user_ids[u]);
+            out_string(q, "name", user_name(u));
+            out_double(q, "activity", user_activity[u]);
+            break;
+
+        case BATCH_MUTUALS: {
+            PairSimilarity pair;
+            int *mutuals = query_scratch(ctx, out_degree(u) + 1);
+            query_mutuals(ctx, u, v, &pair, mutuals);
+            out_begin(q);
+            out_int(q, "count", pair.mutual_count);
+            out_double(q, "jaccard", pair.jaccard);
+            out_double(q, "adamic_adar", pair.adamic_adar);
+            out_list(q, "mutuals", mutuals, pair.mutual_count, true);
+            break;
+        }
+
+        case BATCH_TOP: {
+            TopNQuery query = { RANK_BY_FOLLOWERS, -1, INT_MIN, -1 };
+            if (!parse_batch_int(args[0], 0, INT_MAX, &a)) {
+                out_error(q, "invalid count", args[0]);
+                return;
+            }
+            if (q->arg_count >= 2) {
+                if (strcasecmp(args[1], "activity") == 0) query.key = RANK_BY_ACTIVITY;
+                else if (strcasecmp(args[1], "pagerank") == 0) query.key = RANK_BY_PAGERANK;
+                else if (strcasecmp(args[1], "followers") != 0) {
+                    out_error(q, "invalid criteria", args[1]);
+                    return;
+                }
+            }
+            if (q->arg_count >= 3 && strcmp(args[2], "*") != 0 && (query.country = find_country(args[2])) < 0) {
+                out_begin(q); // an unknown country simply has no users
+                out_list(q, "users", NULL, 0, true);
+                out_list(q, "values", NULL, 0, false);
+                break;
+            }
+            if (q->arg_count >= 4 && strcmp(args[3], "*") != 0) {
+                if (!parse_batch_int(args[3], INT_MIN, INT_MAX, &b)) {
+                    out_error(q, "invalid follower floor", args[3]);
+                    return;
+                }
+                query.min_followers = (int)b;
+            }
+            if (q->arg_count >= 5) {
+                if (!parse_batch_int(args[4], 0, INT_MAX, &b)) {
+                    out_error(q, "invalid community", args[4]);
+                    return;
+                }
+                query.community = (int)b;
+            }
+            int n = a < live_user_count() ? (int)a : live_user_count();
+            int *top = query_scratch(ctx, n);
+            n = top_n_influencers(&query, n, top);
+            out_begin(q);
+            out_list(q, "users", top, n, true);
+            out_key(q, "values");
+            if (batch_json) text_append(&q->out, "[", 1);
+            for (int i = 0; i < n; i++) {
+                if (i) text_append(&q->out, ",", 1);
+                if (query.key == RANK_BY_FOLLOWERS) text_printf(&q->out, "%d", user_followers[top[i]]);
+                else if (query.key == RANK_BY_ACTIVITY) text_printf(&q->out, "%.2f", user_activity[top[i]]);
+                else text_printf(&q->out, "%.6g", pagerank[top[i]]);
+            }
+            if (batch_json) text_append(&q->out, "]", 1);
+            break;
+        }
 
-// Struct to store each user's data
-typedef struct {
-    int id;
-    char name[MAX_NAME];
-    int followers;
-    float activity_score;
-    char country[MAX_COUNTRY];
-    int connections[MAX_CONNECTIONS];
-    int connection_count;
-} User;
+        case BATCH_COUNTRY: {
+            a = INT_MAX;
+            if (q->arg_count >= 2 && !parse_batch_int(args[1], 0, INT_MAX, &a)) {
+                out_error(q, "invalid limit", args[1]);
+                return;
+            }
+            if (q->arg_count >= 3 && !parse_batch_int(args[2], 0, INT_MAX, &b)) {
+                out_error(q, "invalid community", args[2]);
+                return;
+            }
+            int code = find_country(args[0]);
+            int first = code < 0 ? 0 : country_begin(code), count = code < 0 ? 0 : country_end(code) - first;
+            const int *users = country_by_followers + first;
+            if (q->arg_count >= 3) {
+                int *members = query_scratch(ctx, count), kept = 0;
+                for (int k = 0; k < count; k++)
+                    if (community_id[users[k]] == b) members[kept++] = users[k];
+                users = members;
+                count = kept;
+            }
+            out_begin(q);
+            out_int(q, "count", count);
+            out_list(q, "users", users, count < a ? count : (int)a, true);
+            break;
+        }
 
-User users[MAX_USERS];
-int user_count = 0;
+        case BATCH_COMMUNITY: {
+            a = INT_MAX;
+            if (!parse_batch_int(args[0], 0, INT_MAX, &b)) {
+                out_error(q, "invalid community", args[0]);
+                return;
+            }
+            if (q->arg_count >= 2 && !parse_batch_int(args[1], 0, INT_MAX, &a)) {
+                out_error(q, "invalid limit", args[1]);
+                return;
+            }
+            int count;
+            const int *users = query_community((int)b, &count);
+            out_begin(q);
+            out_int(q, "count", count);
+            out_list(q, "users", users, count < a ? count : (int)a, true);
+            break;
+        }
 
-int adj_matrix[MAX_USERS][MAX_USERS];
+        case BATCH_ABOVE: {
+            a = INT_MAX;
+            if (!parse_batch_int(args[0], INT_MIN, INT_MAX, &b) ||
+                (q->arg_count >= 2 && !parse_batch_int(args[1], 0, INT_MAX, &a))) {
+                out_error(q, "invalid number", q->arg_count >= 2 ? args[1] : args[0]);
+                return;
+            }
+            int count = count_followers_above((int)b);
+            out_begin(q);
+            out_int(q, "count", count);
+            out_list(q, "users", follower_order, count < a ? count : (int)a, true);
+            break;
+        }
 
-// Removes the newline character from the end of a string.
-void trim_newline(char *str) {
-    str[strcspn(str, "\n")] = 0;
+        case BATCH_REACH: {
+            if (!parse_batch_int(args[1], 1, BATCH_MAX_HOPS, &a)) {
+                out_error(q, "invalid hop count", args[1]);
+                return;
+            }
+            int counts[BATCH_MAX_HOPS];
+            query_reach(ctx, u, (int)a, counts);
+            out_begin(q);
+            out_int(q, "id", user_ids[u]);
+            out_list(q, "within", counts, (int)a, false);
+            break;
+        }
+
+        case BATCH_PATH: {
+            int *path = query_scratch(ctx, user_count);
+            int hops = query_shortest_path(ctx, u, v, path);
+            out_begin(q);
+            out_int(q, "hops", hops);
+            out_list(q, "path", path, hops + 1, true);
+            break;
+        }
+
+        case BATCH_REACHABLE:
+            out_begin(q);
+            out_bool(q, "reachable", query_reachable(ctx, u, v));
+            break;
+
+        case BATCH_RECOMMEND: {
+            a = RECOMMENDATION_COUNT;
+            if (q->arg_count >= 2 && !parse_batch_int(args[1], 0, 1000, &a)) {
+                out_error(q, "invalid count", args[1]);
+                return;
+            }
+            Recommendation recommendations[1000];
+            int count = query_recommend(ctx, u, (int)a, NULL, recommendations);
+            int *users = query_scratch(ctx, 2 * count), *mutuals = users + count;
+            for (int i = 0; i < count; i++) {
+                users[i] = recommendations[i].user;
+                mutuals[i] = recommendations[i].mutuals;
+            }
+            out_begin(q);
+            out_list(q, "users", users, count, true);
+            out_list(q, "mutuals", mutuals, count, false);
+            break;
+        }
+
+        case BATCH_PAGERANK: {
+            a = RECOMMENDATION_COUNT;
+            if (q->arg_count >= 2 && !parse_batch_int(args[1], 0, 1000, &a)) {
+                out_error(q, "invalid count", args[1]);
+                return;
+            }
+            ScoredUser top[1000];
+            int count = query_personalized_pagerank(ctx, u, (int)a, top);
+            int *users = query_scratch(ctx, count);
+            for (int i = 0; i < count; i++) users[i] = top[i].user;
+            out_begin(q);
+            out_double(q, "pagerank", pagerank[u]);
+            out_list(q, "users", users, count, true);
+            out_key(q, "scores");
+            if (batch_json) text_append(&q->out, "[", 1);
+            for (int i = 0; i < count; i++) {
+                if (i) text_append(&q->out, ",", 1);
+                text_printf(&q->out, "%.6g", top[i].score);
+            }
+            if (batch_json) text_append(&q->out, "]", 1);
+            break;
+        }
+
+        case BATCH_STRUCTURE: {
+            UserStructure structure;
+            query_structure(u, &structure);
+            out_begin(q);
+            out_int(q, "triangles", structure.triangles);
+            out_double(q, "clustering", structure.clustering);
+            out_int(q, "community", structure.community);
+            out_int(q, "community_size", structure.community_size);
+            break;
+        }
+
+        case BATCH_REACH_ESTIMATE: {
+            if (!parse_batch_int(args[1], 1, SKETCH_HOPS, &a)) {
+                out_error(q, "invalid hop count", args[1]);
+                return;
+            }
+            int counts[SKETCH_HOPS];
+            query_reach_estimate(u, (int)a, counts);
+            out_begin(q);
+            out_int(q, "id", user_ids[u]);
+            out_list(q, "within", counts, (int)a, false);
+            break;
+        }
+
+        case BATCH_SIMILAR: {
+            a = RECOMMENDATION_COUNT;
+            if (q->arg_count >= 2 && !parse_batch_int(args[1], 0, 1000, &a)) {
+                out_error(q, "invalid count", args[1]);
+                return;
+            }
+            ScoredUser similar[1000];
+            int count = query_similar(u, (int)a, similar);
+            int *users = query_scratch(ctx, count);
+            for (int i = 0; i < count; i++) users[i] = similar[i].user;
+            out_begin(q);
+            out_list(q, "users", users, count, true);
+            out_key(q, "similarity");
+            if (batch_json) text_append(&q->out, "[", 1);
+            for (int i = 0; i < count; i++) {
+                if (i) text_append(&q->out, ",", 1);
+                text_printf(&q->out, "%.4g", similar[i].score);
+            }
+            if (batch_json) text_append(&q->out, "]", 1);
+            break;
+        }
+
+        case BATCH_FOLLOW:
+        case BATCH_UNFOLLOW: {
+            bool changed = q->command == BATCH_FOLLOW ? add_connection(u, v) : remove_connection(u, v);
+            out_begin(q);
+            out_bool(q, "changed", changed);
+            break;
+        }
+    }
+    out_end(q);
 }
 
-// Parses a string of space-separated integers into an integer array.
-void parse_connections(char *conn_str, int *connections, int *count) {
-    char *token = strtok(conn_str, " ");
-    *count = 0;
-    while (token != NULL && *count < MAX_CONNECTIONS) {
-        connections[(*count)++] = atoi(token);
-        token = strtok(NULL, " ");
+// Runs a group of queries: reads in parallel, then the trailing write (if any).
+static void run_batch_group(BatchQuery *queries, int count, QueryContext *contexts, FILE *output) {
+    INSTRUMENT_SPAN(OP_BATCH_GROUP);
+    bool need_components = false, need_intersections = false, need_pagerank = false;
+    bool need_communities = false, need_triangles = false, need_sketches = false;
+
+    // Resolve every user argument in bulk; the indexes are read-only here.
+    OMP(parallel for schedule(dynamic, 64))
+    for (int i = 0; i < count; i++) {
+        BatchQuery *q = &queries[i];
+        if (q->error) continue;
+        for (int k = 0; k < batch_commands[q->command].user_args; k++)
+            q->users[k] = resolve_user(q->fields[k + 1]);
+    }
+    for (int i = 0; i < count; i++) {
+        need_components |= queries[i].command == BATCH_REACHABLE;
+        need_intersections |= queries[i].command == BATCH_MUTUALS;
+        need_pagerank |= queries[i].command == BATCH_PAGERANK ||
+                         (queries[i].command == BATCH_TOP && queries[i].arg_count >= 2 && strcasecmp(queries[i].fields[2], "pagerank") == 0);
+        need_communities |= queries[i].command == BATCH_COMMUNITY || queries[i].command == BATCH_STRUCTURE ||
+                            (queries[i].command == BATCH_TOP && queries[i].arg_count >= 5) ||
+                            (queries[i].command == BATCH_COUNTRY && queries[i].arg_count >= 3);
+        need_triangles |= queries[i].command == BATCH_STRUCTURE;
+        need_sketches |= queries[i].command == BATCH_REACH_ESTIMATE || queries[i].command == BATCH_SIMILAR;
+    }
+    // Shared caches must be ready before the parallel section reads them.
+    if (need_components) compute_components();
+    if (need_intersections) prepare_intersections();
+    if (need_pagerank) compute_pagerank();
+    if (need_communities) compute_communities();
+    if (need_triangles) compute_triangles();
+    if (need_sketches) compute_sketches();
+
+    int reads = count;
+    if (count > 0 && queries[count - 1].command >= 0 && batch_commands[queries[count - 1].command].write) reads--;
+
+    OMP(parallel for schedule(dynamic, 16))
+    for (int i = 0; i < reads; i++) {
+        int thread = 0;
+#ifdef _OPENMP
+        thread = omp_get_thread_num();
+#endif
+        run_batch_query(&queries[i], &contexts[thread]);
     }
+    if (reads < count) run_batch_query(&queries[reads], &contexts[0]);
+
+    for (int i = 0; i < count; i++) {
+        fwrite(queries[i].out.data, 1, queries[i].out.size, output);
+        free(queries[i].text);
+    }
+    POLL_INSTRUMENTATION();
 }
 
-// Loads user data from a CSV file into the 'users' array.
-void load_users(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        printf("Error opening file!\n");
+// Reads queries from 'input' ("-" for stdin) and writes results to 'output'
+// ("-" for stdout) in TSV or, if 'json' is set, JSON Lines.
+void run_batch(const char *input, const char *output, bool json) {
+    FILE *in = strcmp(input, "-") == 0 ? stdin : fopen(input, "r");
+    if (!in) {
+        printf("Error opening query file!\n");
+        exit(1);
+    }
+    FILE *out = strcmp(output, "-") == 0 ? stdout : fopen(output, "w");
+    if (!out) {
+        printf("Error creating output file!\n");
         exit(1);
     }
+    setvbuf(out, NULL, _IOFBF, 1 << 20);
+    batch_json = json;
+
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    QueryContext *contexts = xcalloc(threads, sizeof(QueryContext)); // sequential within a query
+    BatchQuery *queries = xcalloc(BATCH_GROUP_SIZE, sizeof(BatchQuery));
+    char line[BATCH_MAX_LINE];
+    long long line_number = 0;
+    int count = 0;
 
-    char line[MAX_LINE];
-    fgets(line, sizeof(line), file); // skip header
+    while (fgets(line, sizeof(line), in)) {
+        line_number++;
+        size_t length = strlen(line);
+        bool too_long = length == sizeof(line) - 1 && line[length - 1] != '\n';
+        if (too_long) {
+            int c;
+            while ((c = fgetc(in)) != EOF && c != '\n') {} // drop the rest of the line
+        }
+        char *p = line;
+        while (*p == ' ' || *p == '\r' || *p == '\n') p++;
+        if (!too_long && (*p == '\0' || *p == '#')) continue; // blank line or comment
 
-    while (fgets(line, sizeof(line), file)) {
-        char *token;
-        token = strtok(line, ",");
-        users[user_count].id = atoi(token);
+        BatchQuery *q = &queries[count++];
+        parse_batch_line(q, line, line_number);
+        if (too_long) q->error = "line too long";
+        bool write = !q->error && batch_commands[q->command].write;
+        if (write || count == BATCH_GROUP_SIZE) {
+            run_batch_group(queries, count, contexts, out);
+            count = 0;
+        }
+    }
+    run_batch_group(queries, count, contexts, out);
+    fflush(out);
 
-        token = strtok(NULL, ",");
-        strcpy(users[user_count].name, token);
+    for (int i = 0; i < BATCH_GROUP_SIZE; i++) free(queries[i].out.data);
+    free(queries);
+    for (int t = 0; t < threads; t++) query_context_free(&contexts[t]);
+    free(contexts);
+    if (in != stdin) fclose(in);
+    if (out != stdout) fclose(out);
+}
 
-        token = strtok(NULL, ",");
-        users[user_count].followers = atoi(token);
+// ---------------------------------------------------------------------------
+// Synthetic graphs and benchmarks
+//
+// --generate writes a power-law social graph in the dataset CSV schema using
+// R-MAT degree distributions: each user gets an R-MAT row (a bijective hash of
+// its index, so hubs are spread over the ID range), its number of connections
+// is drawn from that row's share of the edges, and every connection target is
+// drawn from the R-MAT column distribution. Rows are independent, so users are
+// generated in parallel in fixed chunks whose random streams depend only on
+// the seed, and the output is identical for any thread count.
+//
+// --bench loads a dataset, timing each load phase, then runs a fixed mix of
+// random queries through the query API and prints throughput, latency
+// percentiles and peak resident memory as JSON.
+// ---------------------------------------------------------------------------
 
-        token = strtok(NULL, ",");
-        users[user_count].activity_score = atof(token);
+// R-MAT quadrant probabilities (the Graph500 parameters); d = 1 - a - b - c.
+#define RMAT_A 0.57
+#define RMAT_B 0.19
+#define RMAT_C 0.19
+#define GENERATE_CHUNK_USERS 65536
+#define BENCH_DEFAULT_QUERIES 1000
 
-        token = strtok(NULL, ",");
-        strcpy(users[user_count].country, token);
+static const char *generated_first_names[] = {
+    "Alex", "Jordan", "Taylor", "Morgan", "Casey", "Riley", "Jamie", "Avery", "Quinn", "Drew",
+    "Kris", "Skyler", "Reese", "Parker", "Rowan", "Sage", "Emerson", "Finley", "Hayden", "Logan"
+};
+static const char *generated_last_names[] = {
+    "Smith", "Johnson", "Williams", "Brown", "Jones", "Garcia", "Miller", "Davis", "Wilson", "Moore",
+    "Taylor", "Anderson", "Thomas", "Jackson", "White", "Harris", "Martin", "Lee", "Clark", "Lewis"
+};
+static const char *generated_countries[] = {
+    "USA", "India", "UK", "Germany", "Brazil", "Canada", "Australia", "France", "Japan", "Mexico",
+    "Spain", "Italy", "Nigeria", "Indonesia", "South Korea", "Netherlands", "Sweden", "Egypt", "Argentina", "Kenya"
+};
+#define GENERATED_NAME_COUNT 20
+#define GENERATED_COUNTRY_COUNT 20
 
-        token = strtok(NULL, "\n");
-        parse_connections(token, users[user_count].connections, &users[user_count].connection_count);
+// splitmix64: a small, fast generator with independent streams per seed.
+static inline uint64_t random_next(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
 
-        user_count++;
-    }
-    fclose(file);
+// Returns a uniform double in [0, 1).
+static inline double random_uniform(uint64_t *state) {
+    return (random_next(state) >> 11) * (1.0 / 9007199254740992.0);
 }
 
-// Finds the index of a user in the 'users' array by their name (case-insensitive).
-int find_user_by_name(const char *name) {
-    for (int i = 0; i < user_count; i++) {
-        if (strcasecmp(users[i].name, name) == 0) {
-            return i;
+// Draws a Poisson-distributed count with mean 'lambda' (normal approximation
+// for large means).
+static long long random_poisson(uint64_t *state, double lambda) {
+    if (lambda < 30.0) {
+        double limit = exp(-lambda), product = random_uniform(state);
+        long long k = 0;
+        while (product > limit) {
+            product *= random_uniform(state);
+            k++;
         }
+        return k;
     }
-    return -1;
+    double u1 = random_uniform(state), u2 = random_uniform(state);
+    double gaussian = sqrt(-2.0 * log(1.0 - u1)) * cos(6.283185307179586 * u2);
+    double k = floor(lambda + sqrt(lambda) * gaussian + 0.5);
+    return k < 0 ? 0 : (long long)k;
 }
 
-// Finds the index of a user in the 'users' array by their ID.
-int find_user_by_id(int id) {
-    for (int i = 0; i < user_count; i++) {
-        if (users[i].id == id) return i;
-    }
-    return -1;
+// Bijection on [0, 2^scale) that spreads R-MAT rows over user indices.
+typedef struct {
+    int scale;
+    uint64_t mask, multiplier, inverse;
+} RowHash;
+
+static RowHash row_hash_init(int scale) {
+    RowHash hash = { scale, (scale >= 64 ? ~0ull : (1ull << scale) - 1), 0x9E3779B97F4A7C15ull | 1, 0 };
+    uint64_t inverse = hash.multiplier; // Newton's iteration for the inverse mod 2^64
+    for (int i = 0; i < 6; i++) inverse *= 2 - hash.multiplier * inverse;
+    hash.inverse = inverse;
+    return hash;
 }
 
-// Builds an adjacency matrix representing user connections.
-void build_adj_matrix() {
-    for (int i = 0; i < user_count; i++) {
-        for (int j = 0; j < user_count; j++) {
-            adj_matrix[i][j] = 0;
-        }
-    }
-    for (int i = 0; i < user_count; i++) {
-        for (int j = 0; j < users[i].connection_count; j++) {
-            int conn_id = users[i].connections[j];
-            int conn_index = find_user_by_id(conn_id);
-            if (conn_index != -1)
-                adj_matrix[i][conn_index] = 1;
-        }
-    }
+static inline uint64_t row_hash(const RowHash *hash, uint64_t x) {
+    int shift = hash->scale / 2 + 1;
+    x = (x * hash->multiplier) & hash->mask;
+    return x ^ (x >> shift);
 }
 
-// Recursive helper function for Depth-First Search.
-void dfs_util(int v, bool *visited) {
-    visited[v] = true;
-    printf("%d -> ", users[v].id);
-    for (int i = 0; i < user_count; i++) {
-        if (adj_matrix[v][i] && !visited[i])
-            dfs_util(i, visited);
-    }
+static inline uint64_t row_unhash(const RowHash *hash, uint64_t y) {
+    int shift = hash->scale / 2 + 1;
+    uint64_t x = y;
+    for (int s = shift; s < hash->scale; s += shift) x = y ^ (x >> shift);
+    return (x * hash->inverse) & hash->mask;
 }
 
-// Performs Depth-First Search starting from a given user.
-void dfs(int start_index) {
-    bool visited[MAX_USERS] = { false };
-    printf(COLOR_YELLOW "\nDFS traversal starting from user ID %d: " COLOR_RESET, users[start_index].id);
-    dfs_util(start_index, visited);
-    printf("\n");
+// Probability of an R-MAT row (a + b per 0 bit, c + d per 1 bit) or column
+// (a + c per 0 bit, b + d per 1 bit).
+static double rmat_probability(uint64_t x, int scale, double zero) {
+    double p = 1.0;
+    for (int bit = 0; bit < scale; bit++) p *= (x >> bit) & 1 ? 1.0 - zero : zero;
+    return p;
 }
 
-// Performs Breadth-First Search starting from a given user.
-void bfs(int start_index) {
-    bool visited[MAX_USERS] = { false };
-    int queue[MAX_USERS], front = 0, rear = 0;
-    visited[start_index] = true;
-    queue[rear++] = start_index;
-    printf(COLOR_CYAN "\nBFS traversal starting from user ID %d: " COLOR_RESET, users[start_index].id);
-    while (front < rear) {
-        int v = queue[front++];
-        printf("%d -> ", users[v].id);
-        for (int i = 0; i < user_count; i++) {
-            if (adj_matrix[v][i] && !visited[i]) {
-                visited[i] = true;
-                queue[rear++] = i;
-            }
-        }
+// Draws an R-MAT column, using 16 random bits per level.
+static uint64_t rmat_column(uint64_t *state, int scale) {
+    const uint32_t zero = (uint32_t)((RMAT_A + RMAT_C) * 65536.0);
+    uint64_t column = 0, bits = 0;
+    for (int bit = 0; bit < scale; bit++) {
+        if ((bit & 3) == 0) bits = random_next(state);
+        if ((uint32_t)(bits & 0xFFFF) >= zero) column |= 1ull << bit;
+        bits >>= 16;
     }
-    printf("\n");
+    return column;
 }
 
-// Implements the Floyd-Warshall algorithm to find all-pairs shortest paths.
-void floyd_warshall() {
-    int dist[MAX_USERS][MAX_USERS];
-    for (int i = 0; i < user_count; i++) {
-        for (int j = 0; j < user_count; j++) {
-            if (i == j) dist[i][j] = 0;
-            else if (adj_matrix[i][j]) dist[i][j] = 1;
-            else dist[i][j] = INF;
+// Appends the CSV rows of users [first, last) to 'text'.
+static void generate_users(TextBuffer *text, int first, int last, int users, double edges_per_weight,
+                           const RowHash *hash, uint64_t seed) {
+    uint64_t state = seed ^ (0xD1B54A32D192ED03ull * (uint64_t)(first / GENERATE_CHUNK_USERS + 1));
+    int *targets = NULL;
+    long long capacity = 0;
+    for (int u = first; u < last; u++) {
+        uint64_t row = row_hash(hash, (uint64_t)u);
+        long long degree = random_poisson(&state, edges_per_weight * rmat_probability(row, hash->scale, RMAT_A + RMAT_B));
+        if (degree > users - 1) degree = users - 1;
+        if (degree > capacity) {
+            capacity = degree * 2;
+            targets = xrealloc(targets, sizeof(int) * capacity);
         }
-    }
-    for (int k = 0; k < user_count; k++) {
-        for (int i = 0; i < user_count; i++) {
-            for (int j = 0; j < user_count; j++) {
-                if (dist[i][k] + dist[k][j] < dist[i][j])
-                    dist[i][j] = dist[i][k] + dist[k][j];
-            }
+        long long count = 0;
+        for (long long k = 0; k < degree; k++) {
+            uint64_t v;
+            do {
+                v = row_unhash(hash, rmat_column(&state, hash->scale));
+            } while (v >= (uint64_t)users);
+            if ((int)v != u) targets[count++] = (int)v;
         }
-    }
-    printf(COLOR_GREEN "\nShortest path distances between all users (IDs):\n" COLOR_RESET);
-    printf("    ");
-    for (int i = 0; i < user_count && i < 20; i++) printf("%-4d", users[i].id);
-    printf("\n");
-    for (int i = 0; i < user_count && i < 20; i++) {
-        printf("%-4d", users[i].id);
-        for (int j = 0; j < user_count && j < 20; j++) {
-            if (dist[i][j] == INF) printf("INF ");
-            else printf("%-4d", dist[i][j]);
+        qsort(targets, count, sizeof(int), compareInts);
+
+        // Followers track the expected number of incoming connections.
+        double in_share = rmat_probability(row, hash->scale, RMAT_A + RMAT_C);
+        double followers = edges_per_weight * in_share * (50.0 + 950.0 * random_uniform(&state)) + 100.0 * random_uniform(&state);
+        double country = random_uniform(&state);
+        text_printf(text, "%d,%s %s,%d,%.2f,%s,", u + 1,
+                    generated_first_names[random_next(&state) % GENERATED_NAME_COUNT],
+                    generated_last_names[random_next(&state) % GENERATED_NAME_COUNT],
+                    followers > INT_MAX ? INT_MAX : (int)followers,
+                    random_uniform(&state) * 10.0,
+                    generated_countries[(int)(country * country * GENERATED_COUNTRY_COUNT)]);
+        for (long long k = 0; k < count; k++) {
+            if (k > 0 && targets[k] == targets[k - 1]) continue;
+            text_printf(text, k ? " %d" : "%d", targets[k] + 1);
         }
-        printf("\n");
+        text_append(text, "\n", 1);
     }
-    printf("(Displaying first 20 users for brevity)\n");
+    free(targets);
 }
 
-// Shows the mutual connections between two users.
-void show_mutuals(const char *name1, const char *name2) {
-    int idx1 = find_user_by_name(name1);
-    int idx2 = find_user_by_name(name2);
-    if (idx1 == -1 || idx2 == -1) {
-        printf("One or both users not found.\n");
-        return;
+// Writes a synthetic dataset of 'users' users with about 'average_connections'
+// connections each to 'filename'.
+void generate_dataset(const char *filename, int users, double average_connections, uint64_t seed) {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        printf("Error creating dataset file!\n");
+        exit(1);
     }
+    setvbuf(file, NULL, _IOFBF, 1 << 20);
+    fprintf(file, "s.no.,name,followers,activity_score,country,connections\n");
 
-    printf(COLOR_CYAN "\nMutual connections between %s and %s (User IDs):\n" COLOR_RESET, name1, name2);
-    bool found = false;
-    for (int i = 0; i < users[idx1].connection_count; i++) {
-        for (int j = 0; j < users[idx2].connection_count; j++) {
-            if (users[idx1].connections[i] == users[idx2].connections[j]) {
-                int mutual_id = users[idx1].connections[i];
-                int mutual_idx = find_user_by_id(mutual_id);
-                if (mutual_idx != -1) {
-                    printf("- %d (%s, %d followers, %s)\n",
-                           mutual_id,
-                           users[mutual_idx].name,
-                           users[mutual_idx].followers,
-                           users[mutual_idx].country);
-                    found = true;
-                }
-            }
+    int scale = 1;
+    while ((1ll << scale) < users) scale++;
+    RowHash hash = row_hash_init(scale);
+    double weight = 0.0; // sum of the row probabilities of the users
+    for (int u = 0; u < users; u++) weight += rmat_probability(row_hash(&hash, (uint64_t)u), scale, RMAT_A + RMAT_B);
+    double edges_per_weight = average_connections * users / weight;
+
+    int chunks = (users + GENERATE_CHUNK_USERS - 1) / GENERATE_CHUNK_USERS;
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    int round = threads * 2;
+    TextBuffer *texts = xcalloc(round, sizeof(TextBuffer));
+    for (int base = 0; base < chunks; base += round) {
+        int count = chunks - base < round ? chunks - base : round;
+        OMP(parallel for schedule(dynamic, 1))
+        for (int c = 0; c < count; c++) {
+            int first = (base + c) * GENERATE_CHUNK_USERS;
+            int last = first + GENERATE_CHUNK_USERS < users ? first + GENERATE_CHUNK_USERS : users;
+            texts[c].size = 0;
+            generate_users(&texts[c], first, last, users, edges_per_weight, &hash, seed);
         }
+        for (int c = 0; c < count; c++) fwrite(texts[c].data, 1, texts[c].size, file);
     }
-    if (!found) {
-        printf("No mutual connections found.\n");
+    for (int c = 0; c < round; c++) free(texts[c].data);
+    free(texts);
+    if (fclose(file) != 0) {
+        printf("Error writing dataset file!\n");
+        exit(1);
     }
 }
 
-// Comparison function for sorting users by followers (descending)
-int compareByFollowers(const void *a, const void *b) {
-    const User *userA = (const User *)a;
-    const User *userB = (const User *)b;
-    return userB->followers - userA->followers;
+// Returns a monotonic time in seconds.
+static double monotonic_seconds() {
+#ifdef _WIN32
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
 }
 
-// Comparison function for sorting users by activity score (descending)
-int compareByActivity(const void *a, const void *b) {
-    const User *userA = (const User *)a;
-    const User *userB = (const User *)b;
-    if (userB->activity_score > userA->activity_score) return 1;
-    if (userB->activity_score < userA->activity_score) return -1;
+// Returns the peak resident set size of the process in kilobytes (0 if unknown).
+static long peak_rss_kb() {
+#ifdef _WIN32
     return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return usage.ru_maxrss;
+#endif
 }
 
-// Function to print a simple text-based tree
-void printTextTree(User *root, User *parent, int depth, int isLast) {
-    if (root == NULL || depth > 3) return; // Limit depth
-
-    for (int i = 0; i < depth; i++) {
-        printf("%s", (i == depth - 1) ? (isLast ? "└── " : "├── ") : "│   ");
-    }
-    printf("%s (ID: %d, F:%d, A:%.2f, C:%s)\n", root->name, root->id, root->followers, root->activity_score, root->country);
-
-    // Find connected users (excluding parent to avoid cycles in the tree)
-    int connected_count = 0;
-    int connected_indices[MAX_CONNECTIONS];
-    for (int i = 0; i < root->connection_count; i++) {
-        int connected_id = root->connections[i];
-        int connected_index = find_user_by_id(connected_id);
-        if (connected_index != -1 && (parent == NULL || users + connected_index != parent)) {
-            connected_indices[connected_count++] = connected_index;
-        }
-    }
+static int compareDoubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
 
-    // Sort connected users by followers (descending) for tree structure
-    qsort(connected_indices, connected_count, sizeof(int), compareByFollowers);
+// Latencies of one query kind, in seconds.
+typedef struct {
+    const char *name;
+    double *samples;
+    int count;
+    double total;
+} BenchSeries;
 
-    for (int i = 0; i < (connected_count > 3 ? 3 : connected_count); i++) {
-        printTextTree(users + connected_indices[i], root, depth + 1, (i == connected_count - 1));
+// Prints one query kind as a JSON member: count, throughput and latency
+// percentiles (nearest rank) in microseconds.
+static void print_bench_series(FILE *out, BenchSeries *series, bool last) {
+    qsort(series->samples, series->count, sizeof(double), compareDoubles);
+    fprintf(out, "    \"%s\": {\"count\": %d, \"total_ms\": %.3f, \"per_second\": %.1f",
+            series->name, series->count, series->total * 1e3, series->total > 0 ? series->count / series->total : 0.0);
+    static const struct { const char *name; double quantile; } percentiles[] = {
+        { "p50_us", 0.50 }, { "p90_us", 0.90 }, { "p99_us", 0.99 }, { "max_us", 1.0 }
+    };
+    for (int p = 0; p < 4; p++) {
+        int rank = (int)ceil(percentiles[p].quantile * series->count);
+        double value = series->count ? series->samples[(rank > 0 ? rank : 1) - 1] : 0.0;
+        fprintf(out, ", \"%s\": %.2f", percentiles[p].name, value * 1e6);
     }
+    fprintf(out, "}%s\n", last ? "" : ",");
 }
 
-// Shows the top N influencers based on a specified criteria (followers or activity).
-void show_top_n_influencers_by(int n, const char *criteria) {
-    if (n <= 0 || n > user_count) {
-        printf("Invalid number of influencers.\n");
-        return;
-    }
-
-    User sorted_users[MAX_USERS];
-    memcpy(sorted_users, users, sizeof(User) * user_count);
+enum {
+    BENCH_LOOKUP,
+    BENCH_BFS,
+    BENCH_DFS,
+    BENCH_REACH,
+    BENCH_PATH,
+    BENCH_MUTUALS,
+    BENCH_RECOMMEND,
+    BENCH_TOP_N,
+    BENCH_PERSONALIZED_PAGERANK,
+    BENCH_REACH_ESTIMATE,
+    BENCH_SIMILAR,
+    BENCH_KIND_COUNT
+};
 
-    if (strcmp(criteria, "followers") == 0) {
-        qsort(sorted_users, user_count, sizeof(User), compareByFollowers);
-        printf(COLOR_YELLOW "\nTop %d Influencers by Followers:\n" COLOR_RESET, n);
-    } else if (strcmp(criteria, "activity") == 0) {
-        qsort(sorted_users, user_count, sizeof(User), compareByActivity);
-        printf(COLOR_YELLOW "\nTop %d Influencers by Activity Score:\n" COLOR_RESET, n);
-    } else {
-        printf("Invalid sorting criteria.\n");
-        return;
-    }
+// Query kind names and how many queries of each kind to run per 'queries'.
+static const struct {
+    const char *name;
+    int divisor;
+} bench_kinds[BENCH_KIND_COUNT] = {
+    [BENCH_LOOKUP] = { "lookup", 1 },
+    [BENCH_BFS] = { "bfs", 100 },
+    [BENCH_DFS] = { "dfs", 100 },
+    [BENCH_REACH] = { "reach_2_hops", 10 },
+    [BENCH_PATH] = { "shortest_path", 10 },
+    [BENCH_MUTUALS] = { "mutuals", 1 },
+    [BENCH_RECOMMEND] = { "recommend", 1 },
+    [BENCH_TOP_N] = { "top_n", 1 },
+    [BENCH_PERSONALIZED_PAGERANK] = { "personalized_pagerank", 1 },
+    [BENCH_REACH_ESTIMATE] = { "reach_estimate_2_hops", 1 },
+    [BENCH_SIMILAR] = { "similar", 1 },
+};
 
-    for (int i = 0; i < n; i++) {
-        printf("%d. %s (ID: %d) - F:%d, A:%.2f, C:%s\n",
-               i + 1, sorted_users[i].name, sorted_users[i].id, sorted_users[i].followers,
-               sorted_users[i].activity_score, sorted_users[i].country);
-    }
+// Returns a random live user, drawn by file row so that every --reorder
+// order is measured on the same users.
+static int bench_random_user(uint64_t *state) {
+    int u;
+    do {
+        u = row_user((int)(random_next(state) % (uint64_t)user_count));
+    } while (is_user_removed(u));
+    return u;
 }
 
-// Searches for and displays influencers from a specific country.
-void search_by_country(const char *country) {
-    printf(COLOR_GREEN "\nInfluencers from %s:\n" COLOR_RESET, country);
-    bool found = false;
-    for (int i = 0; i < user_count; i++) {
-        if (strcasecmp(users[i].country, country) == 0) {
-            printf("- %s (ID: %d) - F:%d, A:%.2f\n",
-                   users[i].name, users[i].id, users[i].followers, users[i].activity_score);
-            found = true;
-        }
-    }
-    if (!found) {
-        printf("No influencers found from this country.\n");
-    }
-}
+// Runs one query of the given kind and returns its latency in seconds.
+static double run_bench_query(int kind, QueryContext *ctx, uint64_t *state, int *buffer) {
+    int u = bench_random_user(state), v = bench_random_user(state);
+    char id_text[16];
+    snprintf(id_text, sizeof(id_text), "%d", user_ids[u]);
+    TopNQuery query = { (RankKey)(random_next(state) % 3), -1, INT_MIN, -1 };
+    if (random_next(state) & 1) query.country = user_country_ids[u];
+    if ((random_next(state) & 3) == 0) query.min_followers = user_followers[v];
+    int n = 1 + (int)(random_next(state) % 100);
+    PairSimilarity pair;
+    Recommendation recommendations[RECOMMENDATION_COUNT];
+    ScoredUser scored[RECOMMENDATION_COUNT];
+    int counts[2];
 
-// Function to get friend recommendations based on mutual friends
-void recommend_friends(const char *name) {
-    int user_index = find_user_by_name(name);
-    if (user_index == -1) {
-        printf("User not found.\n");
-        return;
+    double start = monotonic_seconds();
+    switch (kind) {
+        case BENCH_LOOKUP: resolve_user(random_next(state) & 1 ? id_text : user_name(u)); break;
+        case BENCH_BFS: query_bfs(ctx, u, buffer); break;
+        case BENCH_DFS: query_dfs(ctx, u, buffer); break;
+        case BENCH_REACH: query_reach(ctx, u, 2, counts); break;
+        case BENCH_PATH: query_shortest_path(ctx, u, v, buffer); break;
+        case BENCH_MUTUALS: query_mutuals(ctx, u, v, &pair, buffer); break;
+        case BENCH_RECOMMEND: query_recommend(ctx, u, RECOMMENDATION_COUNT, NULL, recommendations); break;
+        case BENCH_TOP_N: top_n_influencers(&query, n, buffer); break;
+        case BENCH_PERSONALIZED_PAGERANK: query_personalized_pagerank(ctx, u, RECOMMENDATION_COUNT, scored); break;
+        case BENCH_REACH_ESTIMATE: query_reach_estimate(u, 2, counts); break;
+        case BENCH_SIMILAR: query_similar(u, RECOMMENDATION_COUNT, scored); break;
     }
+    return monotonic_seconds() - start;
+}
 
-    int recommendations[MAX_USERS];
-    int recommendation_count = 0;
-    int mutual_friend_counts[MAX_USERS] = {0};
-    bool already_connected[MAX_USERS] = {false};
-
-    for (int i = 0; i < users[user_index].connection_count; i++) {
-        int connected_id = users[user_index].connections[i];
-        int connected_index = find_user_by_id(connected_id);
-        if (connected_index != -1) {
-            already_connected[connected_index] = true;
-        }
+// Loads 'dataset' and benchmarks it with about 'queries' queries of each
+// cheap kind (fewer for traversals), writing a JSON report to 'output'
+// ("-" for stdout). With 'compress' the queries run on the compressed
+// adjacency.
+void run_benchmark(const char *dataset, int queries, const char *output, GraphOrder order, bool compress) {
+    FILE *out = strcmp(output, "-") == 0 ? stdout : fopen(output, "w");
+    if (!out) {
+        printf("Error creating output file!\n");
+        exit(1);
     }
-    already_connected[user_index] = true;
 
-    for (int i = 0; i < user_count; i++) {
-        if (!already_connected[i]) {
-            for (int j = 0; j < users[user_index].connection_count; j++) {
-                int connected_id = users[user_index].connections[j];
-                int connected_index = find_user_by_id(connected_id);
-                if (connected_index != -1) {
-                    for (int k = 0; k < users[connected_index].connection_count; k++) {
-                        if (users[connected_index].connections[k] == users[i].id) {
-                            mutual_friend_counts[i]++;
-                            break;
-                        }
-                    }
-                }
-            }
-        }
+    struct { const char *name; double seconds; } phases[12];
+    int phase_count = 0;
+#define BENCH_PHASE(label, call) do { \
+        double phase_start = monotonic_seconds(); \
+        call; \
+        phases[phase_count].name = label; \
+        phases[phase_count++].seconds = monotonic_seconds() - phase_start; \
+    } while (0)
+    if (is_snapshot_file(dataset)) {
+        BENCH_PHASE("load_snapshot", load_snapshot(dataset, false));
+    } else {
+        BENCH_PHASE("load_users", load_users(dataset));
+        BENCH_PHASE("build_indexes", build_indexes());
+        BENCH_PHASE("build_graph", build_graph());
+        BENCH_PHASE("reorder", reorder_graph(order));
+        BENCH_PHASE("build_secondary_indexes", build_secondary_indexes());
     }
-
-    for (int i = 0; i < user_count; i++) {
-        if (mutual_friend_counts[i] > 0) {
-            recommendations[recommendation_count++] = i;
-        }
+    if (compress) BENCH_PHASE("compress", compress_graph());
+    BENCH_PHASE("pagerank", compute_pagerank());
+    BENCH_PHASE("communities", compute_communities());
+    BENCH_PHASE("triangles", compute_triangles());
+    BENCH_PHASE("sketches", compute_sketches());
+    BENCH_PHASE("prepare_queries", prepare_concurrent_queries());
+#undef BENCH_PHASE
+    if (live_user_count() == 0) {
+        printf("Error: the dataset has no users!\n");
+        exit(1);
     }
 
-    for (int i = 0; i < recommendation_count - 1; i++) {
-        for (int j = i + 1; j < recommendation_count; j++) {
-            if (mutual_friend_counts[recommendations[i]] < mutual_friend_counts[recommendations[j]]) {
-                int temp = recommendations[i];
-                recommendations[i] = recommendations[j];
-                recommendations[j] = temp;
-            }
+    QueryContext ctx = { .parallel = true };
+    int *buffer = xmalloc(sizeof(int) * (user_count > 100 ? user_count : 100));
+    BenchSeries series[BENCH_KIND_COUNT];
+    uint64_t state = 42;
+    for (int kind = 0; kind < BENCH_KIND_COUNT; kind++) {
+        int count = queries / bench_kinds[kind].divisor;
+        series[kind] = (BenchSeries){ bench_kinds[kind].name, xmalloc(sizeof(double) * (count > 0 ? count : 1)), count > 0 ? count : 1, 0.0 };
+        for (int i = 0; i < series[kind].count; i++) {
+            series[kind].samples[i] = run_bench_query(kind, &ctx, &state, buffer);
+            series[kind].total += series[kind].samples[i];
         }
     }
 
-    printf(COLOR_YELLOW "\nFriend recommendations for %s (ID: %d) based on mutual friends:\n" COLOR_RESET, users[user_index].name, users[user_index].id);
-    if (recommendation_count > 0) {
-        for (int i = 0; i < (recommendation_count > 5 ? 5 : recommendation_count); i++) {
-            int recommended_index = recommendations[i];
-            printf("- %s (ID: %d) - %d mutual friends\n",
-                   users[recommended_index].name, users[recommended_index].id, mutual_friend_counts[recommended_index]);
-        }
-    } else {
-        printf("No friend recommendations found based on mutual connections.\n");
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    fprintf(out, "{\n  \"dataset\": \"");
+    for (const char *p = dataset; *p; p++) fprintf(out, *p == '"' || *p == '\\' ? "\\%c" : "%c", *p);
+    size_t target_bytes = graph_compressed ? packed_adj.size + packed_rev.size : 2 * (size_t)edge_count * sizeof(int);
+    fprintf(out, "\",\n  \"order\": \"%s\",\n  \"compressed\": %s,\n  \"users\": %d,\n  \"connections\": %d,\n",
+            graph_order_names[graph_order], graph_compressed ? "true" : "false", live_user_count(), edge_count);
+    fprintf(out, "  \"bytes_per_edge\": %.3f,\n  \"threads\": %d,\n", edge_count ? target_bytes / (2.0 * edge_count) : 0.0, threads);
+    fprintf(out, "  \"phases_ms\": {");
+    for (int p = 0; p < phase_count; p++)
+        fprintf(out, "%s\"%s\": %.3f", p ? ", " : "", phases[p].name, phases[p].seconds * 1e3);
+    fprintf(out, "},\n  \"queries\": {\n");
+    for (int kind = 0; kind < BENCH_KIND_COUNT; kind++) {
+        print_bench_series(out, &series[kind], kind == BENCH_KIND_COUNT - 1);
+        free(series[kind].samples);
     }
+    fprintf(out, "  },\n  \"peak_rss_kb\": %ld\n}\n", peak_rss_kb());
+    free(buffer);
+    query_context_free(&ctx);
+    if (out != stdout) fclose(out);
 }
 
-// Displays a menu for graph algorithms related to a specific user.
-void graph_algorithms_menu(int start_index) {
-    int choice;
-    while (1) {
-        printf(COLOR_CYAN "\nGraph Algorithms for User ID %d (%s):\n" COLOR_RESET, users[start_index].id, users[start_index].name);
-        printf("1. Depth-First Search (DFS) Traversal (by User ID)\n");
-        printf("2. Breadth-First Search (BFS) Traversal (by User ID)\n");
-        printf("3. All-PairsShortest Path (Floyd-Warshall) (by User ID)\n");
-        printf("4. Return to main menu\n");
-        printf("Choose option: ");
-        scanf("%d", &choice);
-        getchar(); // Consume newline
-
-        if (choice == 4) break;
+int main(int argc, char **argv) {
+    const char *dataset = "e:/C++/DSA/Project/DSA-Project/data/social_dataset_with_connections.csv";
+    const char *batch_input = NULL, *output = "-";
+    bool verify = false, json = false, bench = false, compress = false;
+    int bench_queries = BENCH_DEFAULT_QUERIES;
+    GraphOrder order = ORDER_FILE;
+#ifdef INSTRUMENT
+    install_instrumentation_signal(false);
+#endif
 
-        switch (choice) {
-            case 1:
-                dfs(start_index);
-                break;
-            case 2:
-                bfs(start_index);
-                break;
-            case 3:
-                floyd_warshall();
-                break;
-            default:
-                printf("Invalid choice. Please try again.\n");
-                break;
+    if (argc >= 2 && strcmp(argv[1], "--convert") == 0) {
+        int convert_order = argc == 5 ? find_graph_order(argv[4]) : ORDER_FILE;
+        if ((argc != 4 && argc != 5) || convert_order < 0) {
+            printf("Usage: %s --convert <input.csv> <output.snapshot> [file|degree|bfs|rcm]\n", argv[0]);
+            return 1;
         }
+        load_csv_dataset(argv[2], (GraphOrder)convert_order);
+        save_snapshot(argv[3]);
+        printf("Wrote snapshot of %d users and %d connections to %s\n", user_count, edge_count, argv[3]);
+        return 0;
     }
-}
-
-// Displays the main menu of the social network analysis tool.
-void display_menu() {
-    printf(COLOR_BOLD COLOR_CYAN "\n===== SOCIAL MEDIA NETWORK ANALYSIS =====\n" COLOR_RESET);
-    printf("1. Show user connections count\n");
-    printf("2. Show user activity score\n");
-    printf("3. Find mutual connections between two users (by User ID)\n");
-    printf("4. Show influencers with minimum followers\n");
-    printf("5. Show top N influencers\n");
-    printf("6. Search influencers by country\n");
-    printf("7. Graph algorithms (DFS/BFS/Shortest Path by User ID)\n");
-    printf("8. Friend recommendations based on mutual friends\n");
-    printf("9. Visualize network as tree\n");
-    printf("10. Exit\n");
-    printf(COLOR_BOLD "Enter your choice: " COLOR_RESET);
-}
-
-// Handles the visualization of the network as a text-based tree based on user choice.
-void visualize_network_tree() {
-    int choice;
-    printf("\nVisualize Network Tree Based On:\n");
-    printf("1. Country (Top 3 Influencers)\n");
-    printf("2. Mutual Connections (Starting from a user, max depth/width 3)\n");
-    printf("Enter your choice: ");
-    scanf("%d", &choice);
-    getchar(); // Consume newline
-
-    if (choice == 1) {
-        char country[MAX_COUNTRY];
-        printf("Enter country to visualize top 3 influencers: ");
-        fgets(country, sizeof(country), stdin);
-        trim_newline(country);
-        // Find top 3 influencers from the given country
-        User country_influencers[MAX_USERS];
-        int count = 0;
-        for (int i = 0; i < user_count; i++) {
-            if (strcasecmp(users[i].country, country) == 0) {
-                country_influencers[count++] = users[i];
+    if (argc >= 2 && strcmp(argv[1], "--generate") == 0) {
+        long long users = argc >= 4 ? atoll(argv[3]) : 0;
+        double average = argc >= 5 ? atof(argv[4]) : 10.0;
+        if (argc < 4 || argc > 6 || users < 2 || users > INT_MAX || average < 0) {
+            printf("Usage: %s --generate <output.csv> <users> [average_connections] [seed]\n", argv[0]);
+            return 1;
+        }
+        uint64_t seed = argc >= 6 ? strtoull(argv[5], NULL, 10) : 1;
+        generate_dataset(argv[2], (int)users, average, seed);
+        printf("Wrote %lld users to %s\n", users, argv[2]);
+        return 0;
+    }
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--verify") == 0) verify = true;
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) batch_input = argv[++i];
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) output = argv[++i];
+        else if (strcmp(argv[i], "--bench") == 0) bench = true;
+        else if (strcmp(argv[i], "--compress") == 0) compress = true;
+        else if (strcmp(argv[i], "--queries") == 0 && i + 1 < argc) bench_queries = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--reorder") == 0 && i + 1 < argc) {
+            int mode = find_graph_order(argv[++i]);
+            if (mode < 0) {
+                printf("Usage: %s [--reorder file|degree|bfs|rcm] [dataset]\n", argv[0]);
+                return 1;
             }
+            order = (GraphOrder)mode;
         }
-        qsort(country_influencers, count, sizeof(User), compareByFollowers);
-        printf(COLOR_YELLOW "\nTree visualization of top 3 influencers from %s:\n" COLOR_RESET, country);
-        for (int i = 0; i < (count > 3 ? 3 : count); i++) {
-            printf("└── %s (ID: %d, F:%d, A:%.2f)\n", country_influencers[i].name, country_influencers[i].id, country_influencers[i].followers, country_influencers[i].activity_score);
+        else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+            const char *format = argv[++i];
+            if (strcmp(format, "text") != 0 && strcmp(format, "json") != 0) {
+                printf("Usage: %s [--stats text|json] [dataset]\n", argv[0]);
+                return 1;
+            }
+#ifdef INSTRUMENT
+            install_instrumentation_signal(strcmp(format, "json") == 0);
+            atexit(print_instrumentation_at_exit);
+#else
+            fprintf(stderr, "--stats needs a build with -DINSTRUMENT; ignoring it.\n");
+#endif
         }
-    } else if (choice == 2) {
-        char start_name[MAX_NAME];
-        printf("Enter user name to start mutual connection tree: ");
-        fgets(start_name, sizeof(start_name), stdin);
-        trim_newline(start_name);
-        int start_index = find_user_by_name(start_name);
-        if (start_index != -1) {
-            printf(COLOR_CYAN "\nTree visualization of mutual connections (max depth/width 3):\n" COLOR_RESET);
-            printTextTree(&users[start_index], NULL, 0, 1);
-        } else {
-            printf("User not found.\n");
+        else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            const char *format = argv[++i];
+            if (strcmp(format, "json") == 0) json = true;
+            else if (strcmp(format, "tsv") != 0) {
+                printf("Usage: %s [--batch <queries|-> [--format tsv|json] [--output <file>]] [dataset]\n", argv[0]);
+                return 1;
+            }
         }
-    } else {
-        printf("Invalid choice for tree visualization.\n");
+        else dataset = argv[i];
     }
-}
 
-int main() {
-    load_users("e:/C++/DSA/Project/DSA-Project/data/social_dataset_with_connections.csv");
-    build_adj_matrix();
+    if (bench) {
+        run_benchmark(dataset, bench_queries, output, order, compress);
+        return 0;
+    }
+    load_dataset(dataset, verify, order);
+    if (compress) compress_graph();
+    if (batch_input) {
+        run_batch(batch_input, output, json);
+        return 0;
+    }
 
     printf(COLOR_GREEN "Social Network Analysis System Initialized\n" COLOR_RESET);
     printf("Loaded %d users from dataset\n", user_count);
 
     int choice;
-    char name[MAX_NAME], name2[MAX_NAME], country[MAX_COUNTRY];
+    char name[MAX_NAME], name2[MAX_NAME], country[MAX_COUNTRY], criteria[16];
     int threshold, n, index;
     char continue_choice;
 
     do {
+        POLL_INSTRUMENTATION();
         display_menu();
         scanf("%d", &choice);
         getchar(); // Consume newline
@@ -495,7 +6660,8 @@ int main() {
                 trim_newline(name);
                 index = find_user_by_name(name);
                 if (index != -1) {
-                    printf("%s (ID: %d) has %d connections.\n", users[index].name, users[index].id, users[index].connection_count);
+                    for (; index != -1; index = next_user_with_same_name(index))
+                        printf("%s (ID: %d) has %d connections.\n", user_name(index), user_ids[index], out_degree(index));
                 } else {
                     printf("User not found.\n");
                 }
@@ -507,7 +6673,8 @@ int main() {
                 trim_newline(name);
                 index = find_user_by_name(name);
                 if (index != -1) {
-                    printf("%s (ID: %d) has an activity score of %.2f\n", users[index].name, users[index].id, users[index].activity_score);
+                    for (; index != -1; index = next_user_with_same_name(index))
+                        printf("%s (ID: %d) has an activity score of %.2f\n", user_name(index), user_ids[index], user_activity[index]);
                 } else {
                     printf("User not found.\n");
                 }
@@ -528,11 +6695,10 @@ int main() {
                 scanf("%d", &threshold);
                 getchar();
                 printf("\nInfluencers with more than %d followers:\n", threshold);
-                for (int i = 0; i < user_count; i++) {
-                    if (users[i].followers > threshold) {
-                        printf("- %s (ID: %d) - %d followers (%s)\n",
-                               users[i].name, users[i].id, users[i].followers, users[i].country);
-                    }
+                for (int k = 0, count = count_followers_above(threshold); k < count; k++) {
+                    int i = follower_order[k];
+                    printf("- %s (ID: %d) - %d followers (%s)\n",
+                           user_name(i), user_ids[i], user_followers[i], user_country(i));
                 }
                 break;
 
@@ -540,14 +6706,17 @@ int main() {
                 printf("Enter number of top influencers to show: ");
                 scanf("%d", &n);
                 getchar();
-                show_top_n_influencers_by(n, "followers"); // Default to followers
+                printf("Rank by followers, activity or pagerank [followers]: ");
+                fgets(criteria, sizeof(criteria), stdin);
+                trim_newline(criteria);
+                show_top_n_influencers_by(n, criteria[0] ? criteria : "followers"); // Default to followers
                 break;
 
             case 6:
                 printf("Enter country name: ");
                 fgets(country, sizeof(country), stdin);
                 trim_newline(country);
-                search_by_country(country);
+                search_by_country(country, prompt_community());
                 break;
 
             case 7:
@@ -0,0 +1,79 @@
+#!/bin/sh
+# Batch-mode golden tests. Runs each tests/queries/NAME.tsv over
+# tests/fixture.csv and compares the results with tests/expected/NAME.tsv and
+# tests/expected/NAME.jsonl, then checks that a snapshot of the fixture,
+# --compress and every --reorder order give the same answers.
+#
+#     tests/run_tests.sh [binary]
+#
+# Without a binary, one is built with ${CC:-gcc} and ${CFLAGS:--O2 -fopenmp}.
+set -u
+dir=$(cd "$(dirname "$0")" && pwd)
+fixture=$dir/fixture.csv
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+bin=${1:-}
+if [ -z "$bin" ]; then
+    bin=$work/social_network
+    ${CC:-gcc} ${CFLAGS:--O2 -fopenmp} -o "$bin" "$dir/../DSAProject_B23ME1017_B23CH1023.c" -lm || exit 1
+elif [ ! -x "$bin" ]; then
+    echo "$bin: not an executable"
+    exit 1
+fi
+
+failures=0
+check() { # name expected actual
+    if cmp -s "$2" "$3"; then
+        echo "ok   $1"
+    else
+        echo "FAIL $1"
+        diff "$2" "$3" | head -20
+        failures=$((failures + 1))
+    fi
+}
+
+"$bin" --convert "$fixture" "$work/file.snapshot" > /dev/null || exit 1
+
+# Shortest paths, communities and personalized PageRank scores may
+# legitimately differ between orders (see the README), so they are cut from
+# reordered results; everything else must not change.
+any_order() {
+    awk -F '\t' -v OFS='\t' '$2 != "path" && $2 != "community" { if ($2 == "pagerank" || $2 == "structure") NF = 4; print }' "$1"
+}
+
+for order in degree bfs rcm; do
+    "$bin" --convert "$fixture" "$work/$order.snapshot" "$order" > /dev/null || exit 1
+done
+
+for queries in "$dir"/queries/*.tsv; do
+    name=$(basename "$queries" .tsv)
+    expected=$dir/expected/$name
+    "$bin" --batch "$queries" "$fixture" > "$work/out.tsv"
+    check "$name" "$expected.tsv" "$work/out.tsv"
+    "$bin" --batch "$queries" --format json "$fixture" > "$work/out.jsonl"
+    check "$name json" "$expected.jsonl" "$work/out.jsonl"
+    "$bin" --verify --batch "$queries" "$work/file.snapshot" > "$work/out.tsv"
+    check "$name from a snapshot" "$expected.tsv" "$work/out.tsv"
+    "$bin" --compress --batch "$queries" "$fixture" > "$work/out.tsv"
+    check "$name --compress" "$expected.tsv" "$work/out.tsv"
+
+    any_order "$expected.tsv" > "$work/expected.tsv"
+    for order in degree bfs rcm; do
+        "$bin" --reorder "$order" --batch "$queries" "$fixture" > "$work/out.tsv"
+        any_order "$work/out.tsv" > "$work/ordered.tsv"
+        check "$name --reorder $order" "$work/expected.tsv" "$work/ordered.tsv"
+        "$bin" --reorder "$order" --compress --batch "$queries" "$fixture" > "$work/out.tsv"
+        any_order "$work/out.tsv" > "$work/ordered.tsv"
+        check "$name --reorder $order --compress" "$work/expected.tsv" "$work/ordered.tsv"
+        "$bin" --batch "$queries" "$work/$order.snapshot" > "$work/out.tsv"
+        any_order "$work/out.tsv" > "$work/ordered.tsv"
+        check "$name from a snapshot in $order order" "$work/expected.tsv" "$work/ordered.tsv"
+    done
+done
+
+if [ "$failures" -ne 0 ]; then
+    echo "$failures test(s) failed"
+    exit 1
+fi
+echo "all tests passed"